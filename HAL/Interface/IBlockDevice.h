@@ -15,6 +15,34 @@ namespace HAL
 		error_no_more_blocks = -8,
 	};
 
+	// ioctl() operations shared by several devices.
+	enum block_ioctl
+	{
+		ioctl_get_rssi = 1,				// *(int*)p = latest rssi in dbm
+		ioctl_set_tx_class = 2,			// *(int*)p: traffic class of the following writes
+		ioctl_get_block_flags = 3,		// *(int*)p = block_flags of the block last read()
+	};
+
+	// per block receive flags, see ioctl_get_block_flags.
+	enum block_flags
+	{
+		block_flag_bad_fcs = 1,			// the radio's frame check failed, the block has bit errors somewhere
+	};
+
+	// one segment of a scatter/gather block, see IBlockDevice::writev().
+	typedef struct
+	{
+		const void *data;
+		int size;
+	} block_segment;
+
+	// one gathered block of a batch, see IBlockDevice::write_batch().
+	typedef struct
+	{
+		const block_segment *segments;
+		int segment_count;
+	} block_vector;
+
 	class IBlockDevice
 	{
 	public:
@@ -23,6 +51,16 @@ namespace HAL
 		// returns num bytes written, negative values for error.
 		virtual int write(const void *buf, int block_size) = 0;
 
+		// write a block gathered from segment_count segments, segments are concatenated in order.
+		// devices without native gathering support return error_unsupported, callers should fall back to write().
+		// returns num bytes written, negative values for error.
+		virtual int writev(const block_segment *segments, int segment_count){return error_unsupported;};
+
+		// write block_count gathered blocks in one call, for devices that submit in batches.
+		// devices without batching return error_unsupported, callers should fall back to writev().
+		// returns num blocks written, negative values for error.
+		virtual int write_batch(const block_vector *blocks, int block_count){return error_unsupported;};
+
 		// read a block from rx queue, remove block from the queue if remove == true.
 		// returns num bytes read, negative values for error.
 		virtual int read(void *buf, int max_block_size, bool remove = true) = 0;
@@ -0,0 +1,490 @@
+#include "ARawSocket.h"
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include "radiotap.h"
+
+using namespace HAL;
+
+// same air format as Apcap.cpp, packets from either backend are interchangeable.
+static const uint8_t uint8_taIeeeHeader[] = {
+	0x08, 0x01, 						// FC: frame control
+	0x00, 0x00,							// DID: duration or ID
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,	// address1
+	0x13, 0x22, 0x33, 0x44, 0x55, 0x66,	// address2
+	0x13, 0x22, 0x33, 0x44, 0x55, 0x66,	// address3
+	0x10, 0x86,							// SC: Sequence control
+};
+
+// open a raw packet socket bound to interface, protocol 0 receives nothing.
+static int open_socket(const char *interface, int protocol, char *error)
+{
+	int fd = socket(AF_PACKET, SOCK_RAW, htons(protocol));
+	if (fd < 0)
+	{
+		sprintf(error, "socket(): %s", strerror(errno));
+		return -1;
+	}
+
+	struct sockaddr_ll addr = {0};
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(protocol);
+	addr.sll_ifindex = if_nametoindex(interface);
+	if (addr.sll_ifindex == 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		sprintf(error, "bind(%s): %s", interface, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+namespace androidUAV
+{
+
+// classic BPF accepting frames with our MAC signature and port on address2,
+// the 802.11 header starts after the variable length radiotap header.
+static int attach_filter(int fd, int port)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 3),				// x = radiotap length, little endian
+		BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 2),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_IND, 10),				// address2[0~3]
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x13223344, 0, 3),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 14),				// address2[4~5]
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)(0x5500 | port), 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {sizeof(code)/sizeof(code[0]), code};
+
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+ARAWSOCK_RX::ARAWSOCK_RX(const char*interface /*= "wlan0"*/, int port /*= 0*/)
+{
+	doorbell = &own_doorbell;
+
+	init_ok = false;
+	worker_run = false;
+	worker_thread = 0;
+	kernel_ring = NULL;
+	kernel_ring_size = 0;
+	current_block = 0;
+	latest_rssi = 0;
+	last_read_flags = 0;
+	this->port = radiotap_port_byte(port);
+
+	char szErrbuf[256] = {0};
+	int version = TPACKET_V3;
+	struct tpacket_req3 req = {0};
+
+	// the ring must be configured before bind(), or packets are queued to the socket meanwhile.
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0)
+	{
+		sprintf(szErrbuf, "socket(): %s", strerror(errno));
+		goto fail;
+	}
+
+	// without the kernel filter every frame on the channel is copied to us, handle_packet() still checks the MAC.
+	if (attach_filter(fd, this->port) < 0)
+		fprintf(stderr, "ARAWSOCK_RX: BPF filter failed: %s, filtering in user space\n", strerror(errno));
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+	{
+		sprintf(szErrbuf, "TPACKET_V3: %s", strerror(errno));
+		goto fail;
+	}
+
+	req.tp_block_size = ARAWSOCK_BLOCK_SIZE;
+	req.tp_block_nr = ARAWSOCK_BLOCK_COUNT;
+	req.tp_frame_size = 2048;
+	req.tp_frame_nr = ARAWSOCK_BLOCK_SIZE * ARAWSOCK_BLOCK_COUNT / req.tp_frame_size;
+	req.tp_retire_blk_tov = ARAWSOCK_BLOCK_TIMEOUT;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+	{
+		sprintf(szErrbuf, "PACKET_RX_RING: %s", strerror(errno));
+		goto fail;
+	}
+
+	kernel_ring_size = ARAWSOCK_BLOCK_SIZE * ARAWSOCK_BLOCK_COUNT;
+	kernel_ring = (uint8_t*)mmap(NULL, kernel_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (kernel_ring == MAP_FAILED)
+	{
+		kernel_ring = NULL;
+		sprintf(szErrbuf, "mmap(): %s", strerror(errno));
+		goto fail;
+	}
+
+	{
+		struct sockaddr_ll addr = {0};
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(ETH_P_ALL);
+		addr.sll_ifindex = if_nametoindex(interface);
+		if (addr.sll_ifindex == 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		{
+			sprintf(szErrbuf, "bind(%s): %s", interface, strerror(errno));
+			goto fail;
+		}
+	}
+
+	init_ok = true;
+	worker_run = true;
+	pthread_create(&worker_thread, NULL, worker_entry, this);
+	fprintf(stderr, "ARAWSOCK_RX: init OK\n");
+	return;
+
+fail:
+	fprintf(stderr, "ARAWSOCK_RX: init failed, error=%s\n", szErrbuf);
+	clearup();
+}
+
+ARAWSOCK_RX::~ARAWSOCK_RX()
+{
+	clearup();
+}
+
+int ARAWSOCK_RX::clearup()
+{
+	// signal the worker thread to exit, it polls with a timeout
+	worker_run = false;
+	if (worker_thread)
+		pthread_join(worker_thread, NULL);
+	worker_thread = 0;
+
+	if (kernel_ring)
+		munmap(kernel_ring, kernel_ring_size);
+	kernel_ring = NULL;
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	init_ok = false;
+
+	return 0;
+}
+
+int ARAWSOCK_RX::write(const void *buf, int block_size)
+{
+	return error_unsupported;
+}
+
+int ARAWSOCK_RX::read(void *buf, int max_block_size, bool remove /*= true*/)
+{
+	int size = rx_ring.pop(buf, max_block_size, remove, &last_read_flags);
+
+	return size < 0 ? error_no_more_blocks : size;
+}
+
+int ARAWSOCK_RX::available()
+{
+	return rx_ring.count();
+}
+
+int ARAWSOCK_RX::ioctl(int op, void *p, int count)
+{
+	if (count < (int)sizeof(int))
+		return error_unsupported;
+
+	if (op == ioctl_get_rssi)
+		*(int*)p = latest_rssi;
+	else if (op == ioctl_get_block_flags)
+		*(int*)p = last_read_flags;
+	else
+		return error_unsupported;
+
+	return 0;
+}
+
+int ARAWSOCK_RX::peek(const void **data, int *flags/* = NULL*/)
+{
+	const uint8_t *p;
+	int size = rx_ring.peek(&p, flags);
+	if (size < 0)
+		return error_no_more_blocks;
+
+	*data = p;
+	return size;
+}
+
+int ARAWSOCK_RX::consume()
+{
+	rx_ring.consume();
+	return 0;
+}
+
+int ARAWSOCK_RX::wait(int timeout)
+{
+	if (!init_ok)
+		return rx_ring.count();
+
+	doorbell->wait(timeout, ready_entry, this);
+	return rx_ring.count();
+}
+
+// strip radiotap and 802.11 headers of one captured packet and queue the payload.
+void ARAWSOCK_RX::handle_packet(const uint8_t *data, int size)
+{
+	if (size < 4)
+		return;
+
+	int radiotap_length = data[2] + (data[3] << 8);
+	const uint8_t *ieee = data + radiotap_length;
+	if (size < radiotap_length + (int)sizeof(uint8_taIeeeHeader))
+		return;
+
+	// not ours or another port
+	if (memcmp(ieee+10, uint8_taIeeeHeader+10, 5) != 0 || ieee[15] != port)
+		return;
+
+	int radiotap_flags = 0;
+	struct ieee80211_radiotap_iterator rti;
+	if (ieee80211_radiotap_iterator_init(&rti, (struct ieee80211_radiotap_header *)data, size) < 0)
+		return;
+
+	while (ieee80211_radiotap_iterator_next(&rti) == 0)
+	{
+		switch (rti.this_arg_index)
+		{
+		case IEEE80211_RADIOTAP_FLAGS:
+			radiotap_flags = *rti.this_arg;
+			break;
+
+		case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+			latest_rssi = (int8_t)(*rti.this_arg);
+			break;
+		}
+	}
+
+	int byte_count = size - radiotap_length - sizeof(uint8_taIeeeHeader);
+	if (radiotap_flags & IEEE80211_RADIOTAP_F_FCS)
+		byte_count -= 4;
+	if (byte_count <= 0)
+		return;
+
+	// the packet is dropped if the reader falls behind.
+	uint8_t *slot = rx_ring.reserve(byte_count);
+	if (slot)
+	{
+		memcpy(slot, ieee + sizeof(uint8_taIeeeHeader), byte_count);
+		rx_ring.commit(byte_count, (radiotap_flags & IEEE80211_RADIOTAP_F_BADFCS) ? block_flag_bad_fcs : 0);
+	}
+}
+
+void* ARAWSOCK_RX::worker()
+{
+	while(worker_run)
+	{
+		struct tpacket_block_desc *block = (struct tpacket_block_desc*)(kernel_ring + current_block * ARAWSOCK_BLOCK_SIZE);
+
+		if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+		{
+			// nothing retired yet, sleep until the kernel hands over a block (100ms timeout)
+			struct pollfd pfd = {fd, POLLIN | POLLERR, 0};
+			poll(&pfd, 1, 100);
+			continue;
+		}
+
+		// walk all packets of the block, then return it to the kernel.
+		int packet_count = block->hdr.bh1.num_pkts;
+		struct tpacket3_hdr *hdr = (struct tpacket3_hdr*)((uint8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+		for(int i=0; i<packet_count; i++)
+		{
+			const struct sockaddr_ll *ll = (const struct sockaddr_ll*)((uint8_t*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			// skip our own injected packets and truncated captures
+			if (ll->sll_pkttype != PACKET_OUTGOING && hdr->tp_snaplen == hdr->tp_len)
+				handle_packet((uint8_t*)hdr + hdr->tp_mac, hdr->tp_snaplen);
+
+			hdr = (struct tpacket3_hdr*)((uint8_t*)hdr + hdr->tp_next_offset);
+		}
+
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		current_block = (current_block + 1) % ARAWSOCK_BLOCK_COUNT;
+
+		// one wakeup per block instead of per packet.
+		if (packet_count > 0)
+			doorbell->ring();
+	}
+
+	return 0;
+}
+
+
+
+ARAWSOCK_TX::ARAWSOCK_TX(const char *interface, int port)
+{
+	init_ok = false;
+	this->port = radiotap_port_byte(port);
+
+	char szErrbuf[256] = {0};
+	fd = open_socket(interface, 0, szErrbuf);
+	if (fd < 0)
+		goto fail;
+
+	current_class = tx_class_video;
+	{
+		radiotap_tx_params params;
+		radiotap_default_tx_params(&params);
+		for(int i=0; i<tx_class_count; i++)
+			set_tx_params(i, &params);
+	}
+
+	// header iovec is pointed to the class header of each batch.
+	memset(msgs, 0, sizeof(msgs));
+	for(int i=0; i<ARAWSOCK_TX_BATCH; i++)
+		msgs[i].msg_hdr.msg_iov = iovs[i];
+
+	init_ok = true;
+	return;
+fail:
+	printf("ARAWSOCK_TX init failed, error=%s\n", szErrbuf);
+	init_ok = false;
+}
+
+ARAWSOCK_TX::~ARAWSOCK_TX()
+{
+	clearup();
+}
+
+int ARAWSOCK_TX::clearup()
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	init_ok = false;
+
+	return 0;
+}
+
+int ARAWSOCK_TX::write(const void *buf, int block_size)
+{
+	block_segment segment = {buf, block_size};
+	int o = writev(&segment, 1);
+	return o<0 ? o : 0;
+}
+
+int ARAWSOCK_TX::writev(const block_segment *segments, int segment_count)
+{
+	block_vector block = {segments, segment_count};
+	int o = write_batch(&block, 1);
+	if (o < 0)
+		return o;
+
+	int block_size = 0;
+	for(int i=0; i<segment_count; i++)
+		block_size += segments[i].size;
+	return block_size;
+}
+
+int ARAWSOCK_TX::set_tx_params(int tx_class, const radiotap_tx_params *params)
+{
+	if (tx_class < 0 || tx_class >= tx_class_count)
+		return -1;
+
+	uint8_t header[RADIOTAP_TX_MAX_HEADER];
+	int size = radiotap_build_tx_header(header, params);
+	if (size < 0)
+		return -1;
+
+	memcpy(class_header[tx_class], header, size);
+	memcpy(class_header[tx_class]+size, uint8_taIeeeHeader, sizeof(uint8_taIeeeHeader));
+	class_header[tx_class][size+15] = port;		// address2
+	class_header[tx_class][size+21] = port;		// address3
+	class_header_size[tx_class] = size + sizeof(uint8_taIeeeHeader);
+
+	return 0;
+}
+
+int ARAWSOCK_TX::set_tx_class(int tx_class)
+{
+	if (tx_class < 0 || tx_class >= tx_class_count)
+		return -1;
+
+	current_class = tx_class;
+	return 0;
+}
+
+int ARAWSOCK_TX::ioctl(int op, void *p, int count)
+{
+	if (op != ioctl_set_tx_class || count < (int)sizeof(int))
+		return error_unsupported;
+
+	return set_tx_class(*(int*)p);
+}
+
+int ARAWSOCK_TX::write_batch(const block_vector *blocks, int block_count)
+{
+	return write_batch_class(current_class, blocks, block_count);
+}
+
+int ARAWSOCK_TX::write_batch_class(int tx_class, const block_vector *blocks, int block_count)
+{
+	if (!init_ok)
+		return error_unsupported;
+	if (tx_class < 0 || tx_class >= tx_class_count)
+		return -1;
+
+	int sent = 0;
+	while (sent < block_count)
+	{
+		int batch = block_count - sent;
+		if (batch > ARAWSOCK_TX_BATCH)
+			batch = ARAWSOCK_TX_BATCH;
+
+		for(int i=0; i<batch; i++)
+		{
+			const block_vector &block = blocks[sent+i];
+			if (block.segment_count > ARAWSOCK_MAX_SEGMENTS)
+				return sent > 0 ? sent : error_buffer_too_small;
+
+			for(int j=0; j<block.segment_count; j++)
+			{
+				iovs[i][j+1].iov_base = (void*)block.segments[j].data;
+				iovs[i][j+1].iov_len = block.segments[j].size;
+			}
+			iovs[i][0].iov_base = class_header[tx_class];
+			iovs[i][0].iov_len = class_header_size[tx_class];
+			msgs[i].msg_hdr.msg_iovlen = block.segment_count + 1;
+		}
+
+		// a blocking socket sends the whole batch unless an error occurs.
+		int o = sendmmsg(fd, msgs, batch, 0);
+		if (o <= 0)
+		{
+			if (o < 0 && errno == EINTR)
+				continue;
+			perror("ARAWSOCK_TX: sendmmsg");
+			return sent > 0 ? sent : -2;
+		}
+		sent += o;
+	}
+
+	return sent;
+}
+
+int ARAWSOCK_TX::read(void *buf, int max_block_size, bool remove/* = true*/)
+{
+	return error_unsupported;
+}
+
+int ARAWSOCK_TX::available()
+{
+	return error_unsupported;
+}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdint.h>
+#include <HAL/Interface/IBlockDevice.h>
+#include <utils/packet_ring.h>
+#include <utils/doorbell.h>
+#include "radiotap_tx.h"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace androidUAV
+{
+	// monitor mode block devices on a raw AF_PACKET socket, same air format as APCAP_RX/APCAP_TX.
+	// RX maps a TPACKET_V3 ring and walks whole blocks of packets per wakeup,
+	// TX submits a batch of packets with one sendmmsg(), the radiotap/802.11 header is shared, not copied.
+	const int ARAWSOCK_RX_RING_SIZE = 256*1024;		// bytes, user space ring, about 1000 FEC packets
+	const int ARAWSOCK_BLOCK_SIZE = 32*1024;		// bytes, kernel ring block
+	const int ARAWSOCK_BLOCK_COUNT = 32;
+	const int ARAWSOCK_BLOCK_TIMEOUT = 1;			// ms, a partly filled block is handed over after this
+	const int ARAWSOCK_TX_BATCH = 64;				// packets per sendmmsg()
+	const int ARAWSOCK_MAX_SEGMENTS = 7;			// segments per packet, excluding the header
+
+	class ARAWSOCK_RX : public HAL::IBlockDevice
+	{
+	public:
+		// port: last byte of the MAC addresses, see APCAP_DEFAULT_PORT. other frames are dropped by a kernel BPF filter.
+		ARAWSOCK_RX(const char*interface = "wlan0", int port = 0);
+		~ARAWSOCK_RX();
+
+		// write a block
+		// class implementation is responsible for queueing blocks, or reject incoming blocks by returning an error.
+		// returns num bytes written, negative values for error.
+		virtual int write(const void *buf, int block_size);
+
+		// read a block from rx queue, remove block from the queue if remove == true.
+		// returns num bytes read, negative values for error.
+		virtual int read(void *buf, int max_block_size, bool remove = true);
+
+		// query num available blocks in rx queue, negative values for error.
+		virtual int available();
+
+		// zero-copy read: returns size of the first block and points *data to it, error_no_more_blocks if empty.
+		// the block stays valid until consume(). *flags gets its HAL::block_flags if flags is not NULL.
+		int peek(const void **data, int *flags = NULL);
+		int consume();
+
+		// wait up to timeout(us) for incoming blocks, returns num available blocks, 0 on timeout.
+		int wait(int timeout);
+
+		// ring d instead of the device's own doorbell when blocks arrive,
+		// several devices sharing one doorbell can be waited on together. NULL to restore.
+		void set_doorbell(Doorbell *d){doorbell = d ? d : &own_doorbell;}
+
+		// return latest rssi in dbm.
+		int get_latest_rssi(){return latest_rssi;}
+
+		// HAL::ioctl_get_rssi, HAL::ioctl_get_block_flags
+		virtual int ioctl(int op, void *p, int count);
+
+	protected:
+		bool worker_run;
+		pthread_t worker_thread;
+		Doorbell own_doorbell;
+		Doorbell *doorbell;
+		PacketRing<ARAWSOCK_RX_RING_SIZE> rx_ring;		// worker thread -> reader, single producer single consumer
+		bool init_ok;
+		int fd;
+		int port;
+		uint8_t *kernel_ring;				// mmap'ed TPACKET_V3 blocks
+		int kernel_ring_size;
+		int current_block;
+		int latest_rssi;
+		int last_read_flags;			// block_flags of the last read(), reader side
+
+		int clearup();
+		void handle_packet(const uint8_t *data, int size);
+
+		void* worker();
+		static void * worker_entry(void *p){return ((ARAWSOCK_RX*)p)->worker();}
+		static int ready_entry(void *p){return ((ARAWSOCK_RX*)p)->worker_run ? ((ARAWSOCK_RX*)p)->rx_ring.count() : -1;}
+	};
+
+	class ARAWSOCK_TX : public HAL::IBlockDevice
+	{
+	public:
+		// port: last byte of the MAC addresses, see APCAP_DEFAULT_PORT.
+		ARAWSOCK_TX(const char*interface, int port);
+		~ARAWSOCK_TX();
+
+		// write a block
+		// class implementation is responsible for queueing blocks, or reject incoming blocks by returning an error.
+		// returns num bytes written, negative values for error.
+		virtual int write(const void *buf, int block_size);
+
+		// gather segments behind the shared radiotap/802.11 header with sendmsg(), no user space copy.
+		virtual int writev(const HAL::block_segment *segments, int segment_count);
+
+		// all blocks with sendmmsg(), ARAWSOCK_TX_BATCH packets per syscall.
+		virtual int write_batch(const HAL::block_vector *blocks, int block_count);
+
+		// write_batch() with the radiotap parameters of tx_class.
+		int write_batch_class(int tx_class, const HAL::block_vector *blocks, int block_count);
+
+		virtual int read(void *buf, int max_block_size, bool remove = true);
+
+		// query num available blocks in rx queue, negative values for error.
+		virtual int available();
+
+		// radiotap parameters of a traffic class, used from the next write of that class.
+		// not synchronized with writes from other threads, configure before sending.
+		int set_tx_params(int tx_class, const radiotap_tx_params *params);
+
+		// traffic class of write()/writev()/write_batch(), tx_class_video by default.
+		int set_tx_class(int tx_class);
+
+		// HAL::ioctl_set_tx_class
+		virtual int ioctl(int op, void *p, int count);
+
+	protected:
+		bool init_ok;
+		int fd;
+		int port;
+		int current_class;
+		uint8_t class_header[tx_class_count][RADIOTAP_TX_MAX_HEADER + IEEE80211_TX_HEADER];	// radiotap + 802.11 header
+		int class_header_size[tx_class_count];
+		struct mmsghdr msgs[ARAWSOCK_TX_BATCH];
+		struct iovec iovs[ARAWSOCK_TX_BATCH][ARAWSOCK_MAX_SEGMENTS+1];
+
+		int clearup();
+	};
+}
@@ -1,5 +1,6 @@
 #include "AUDP.h"
 #include <unistd.h>
+#include <sys/uio.h>
 
 using namespace std;
 using namespace HAL;
@@ -174,6 +175,30 @@ int AUDP_TX::write(const void *buf, int block_size)
 	return o<0 ? o : block_size;
 }
 
+int AUDP_TX::writev(const block_segment *segments, int segment_count)
+{
+	struct iovec iov[16];
+	if (segment_count > (int)(sizeof(iov)/sizeof(iov[0])))
+		return error_buffer_too_small;
+
+	int block_size = 0;
+	for(int i=0; i<segment_count; i++)
+	{
+		iov[i].iov_base = (void*)segments[i].data;
+		iov[i].iov_len = segments[i].size;
+		block_size += segments[i].size;
+	}
+
+	struct msghdr msg = {0};
+	msg.msg_name = &address;
+	msg.msg_namelen = sizeof(address);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = segment_count;
+
+	int o = sendmsg(socket_descriptor, &msg, 0);
+	return o<0 ? o : block_size;
+}
+
 int AUDP_TX::read(void *buf, int max_block_size, bool remove/* = true*/)
 {
 	return error_unsupported;
@@ -69,6 +69,9 @@ namespace androidUAV
 		// returns num bytes written, negative values for error.
 		virtual int write(const void *buf, int block_size);
 
+		// gather segments with sendmsg(), no user space copy.
+		virtual int writev(const HAL::block_segment *segments, int segment_count);
+
 		virtual int read(void *buf, int max_block_size, bool remove = true);
 
 		// query num available blocks in rx queue, negative values for error.
@@ -1,23 +1,13 @@
 #include "Apcap.h"
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include "radiotap.h"
 
 using namespace std;
 using namespace HAL;
 
-static const uint8_t uint8_taRadiotapHeader[] = {			// radiotap TX header
-	0x00, 0x00, // <-- radiotap version
-	0x0c, 0x00, // <- radiotap header lengt
-	0x04, 0x80, 0x00, 0x00, // <-- bitmap
-	0x22, 		// rate
-	0x0, 		// txpower
-	0x18,		// rtx_retries
-	0x00,		// data_retries
-};
-
-
-
 typedef struct  {
 	int m_nChannel;
 	int m_nChannelFlags;
@@ -35,7 +25,7 @@ static int64_t getus()
    return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec/1000;    
 }
 /* Penumbra IEEE80211 header */
-static uint8_t uint8_taIeeeHeader[] = {
+static const uint8_t uint8_taIeeeHeader[] = {
 	0x08, 0x01, 						// FC: frame control
 	0x00, 0x00,							// DID: duration or ID
 	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,	// address1
@@ -47,12 +37,62 @@ static uint8_t uint8_taIeeeHeader[] = {
 namespace androidUAV
 {
 
-APCAP_RX::APCAP_RX(const char*interface /*= INADDR_ANY*/, int port /*= 0xbbb*/)
+APCAP_RX_STREAM::APCAP_RX_STREAM(APCAP_RX *owner, int port)
+:owner(owner)
+,port(port)
+{
+	doorbell = &own_doorbell;
+}
+
+int APCAP_RX_STREAM::read(void *buf, int max_block_size, bool remove /*= true*/)
+{
+	int size = rx_ring.pop(buf, max_block_size, remove);
+
+	return size < 0 ? error_no_more_blocks : size;
+}
+
+int APCAP_RX_STREAM::peek(const void **data)
+{
+	const uint8_t *p;
+	int size = rx_ring.peek(&p);
+	if (size < 0)
+		return error_no_more_blocks;
+
+	*data = p;
+	return size;
+}
+
+int APCAP_RX_STREAM::wait(int timeout)
 {
-	pthread_mutex_init(&cs, NULL);
+	if (!owner->init_ok)
+		return rx_ring.count();
+
+	doorbell->wait(timeout, ready_entry, this);
+	return rx_ring.count();
+}
+
+int APCAP_RX_STREAM::ready_entry(void *p)
+{
+	APCAP_RX_STREAM *stream = (APCAP_RX_STREAM*)p;
+	return stream->owner->worker_run ? stream->rx_ring.count() : -1;
+}
+
+APCAP_RX::APCAP_RX(const char*interface /*= "wlan0"*/, int port /*= 0*/, const int *extra_ports /*= NULL*/, int extra_port_count /*= 0*/)
+{
+	doorbell = &own_doorbell;
 
 	init_ok = false;
-	byte_counter = 0;
+	worker_run = false;
+	latest_rssi = 0;
+	last_read_flags = 0;
+	memset(&stats, 0, sizeof(stats));
+	this->port = radiotap_port_byte(port);
+	stream_count = 0;
+	for(int i=0; i<extra_port_count && stream_count < APCAP_MAX_STREAMS; i++)
+	{
+		if (radiotap_port_byte(extra_ports[i]) != this->port && !get_stream(extra_ports[i]))
+			streams[stream_count++] = new APCAP_RX_STREAM(this, radiotap_port_byte(extra_ports[i]));
+	}
 
 	char szErrbuf[PCAP_ERRBUF_SIZE] = {0};
 	ppcap = pcap_open_live(interface, MAX_PACKET_LENGTH, 1, -1, szErrbuf);
@@ -62,13 +102,10 @@ APCAP_RX::APCAP_RX(const char*interface /*= INADDR_ANY*/, int port /*= 0xbbb*/)
 	if (pcap_datalink(ppcap) == DLT_IEEE802_11_RADIO)
 	{
 		n80211HeaderLength = sizeof(uint8_taIeeeHeader);
-		char szErrbuf[PCAP_ERRBUF_SIZE];
-		char szProgram[512];
-		struct bpf_program bpfprogram;
-		sprintf(szProgram, "ether[0x0a:4]==0x13223344 && ether[0x0e:2] == 0x55%.2x", 0x66);
-		pcap_compile(ppcap, &bpfprogram, szProgram, 1, 0);
-		//pcap_setfilter(ppcap, &bpfprogram);
-		pcap_freecode(&bpfprogram);
+
+		// without the kernel filter every frame on the channel is copied to us, the worker still checks the MAC.
+		if (set_filter() < 0)
+			fprintf(stderr, "APCAP_RX: BPF filter failed: %s, filtering in user space\n", pcap_geterr(ppcap));
 	}
 	else if (pcap_datalink(ppcap) == DLT_PRISM_HEADER)
 	{
@@ -99,7 +136,36 @@ fail:
 APCAP_RX::~APCAP_RX()
 {
 	clearup();
-	pthread_mutex_destroy(&cs);
+	for(int i=0; i<stream_count; i++)
+		delete streams[i];
+}
+
+APCAP_RX_STREAM *APCAP_RX::get_stream(int port)
+{
+	for(int i=0; i<stream_count; i++)
+		if (streams[i]->port == radiotap_port_byte(port))
+			return streams[i];
+
+	return NULL;
+}
+
+// kernel filter for our MAC signature on address2, with the port byte of this device and its streams.
+int APCAP_RX::set_filter()
+{
+	char szProgram[512];
+	int len = sprintf(szProgram, "ether[0x0a:4]==0x13223344 && ether[0x0e:1]==0x55 && (ether[0x0f:1]==0x%02x", port);
+	for(int i=0; i<stream_count; i++)
+		len += sprintf(szProgram + len, " || ether[0x0f:1]==0x%02x", streams[i]->port);
+	strcat(szProgram, ")");
+
+	struct bpf_program bpfprogram;
+	if (pcap_compile(ppcap, &bpfprogram, szProgram, 1, 0) < 0)
+		return -1;
+
+	int o = pcap_setfilter(ppcap, &bpfprogram);
+	pcap_freecode(&bpfprogram);
+
+	return o < 0 ? -1 : 0;
 }
 
 int APCAP_RX::clearup()
@@ -128,34 +194,74 @@ int APCAP_RX::write(const void *buf, int block_size)
 // returns num bytes read, negative values for error.
 int APCAP_RX::read(void *buf, int max_block_size, bool remove /*= true*/)
 {
-	pthread_mutex_lock(&cs);
-
-	if (packets.size() == 0)
-	{
-		pthread_mutex_unlock(&cs);
-		return error_no_more_blocks;
-	}
+	int size = rx_ring.pop(buf, max_block_size, remove, &last_read_flags);
 
-	packet p = packets.front();
-	if (remove)
-		packets.pop_front();
-	int size = min(max_block_size, p.size);
-	memcpy(buf, p.data, size);
-	pthread_mutex_unlock(&cs);
-
-	return size;
+	return size < 0 ? error_no_more_blocks : size;
 }
 
 // query num available blocks in rx queue, negative values for error.
 int APCAP_RX::available()
 {
-	pthread_mutex_lock(&cs);
+	return rx_ring.count();
+}
+
+int APCAP_RX::ioctl(int op, void *p, int count)
+{
+	if (count < (int)sizeof(int))
+		return error_unsupported;
+
+	if (op == ioctl_get_rssi)
+		*(int*)p = latest_rssi;
+	else if (op == ioctl_get_block_flags)
+		*(int*)p = last_read_flags;
+	else
+		return error_unsupported;
+
+	return 0;
+}
+
+int APCAP_RX::get_stats(apcap_rx_stats *out)
+{
+	*out = stats;
+
+	out->queue_depth = rx_ring.count();
+	for(int i=0; i<stream_count; i++)
+		out->queue_depth += streams[i]->rx_ring.count();
+
+	struct pcap_stat ps;
+	if (init_ok && pcap_stats(ppcap, &ps) == 0)
+		out->kernel_dropped = ps.ps_drop;
+
+	out->rssi = latest_rssi;
+	stats_fill_header(&out->header, stats_apcap_rx, sizeof(*out), getus());
+
+	return 0;
+}
+
+int APCAP_RX::peek(const void **data, int *flags/* = NULL*/)
+{
+	const uint8_t *p;
+	int size = rx_ring.peek(&p, flags);
+	if (size < 0)
+		return error_no_more_blocks;
+
+	*data = p;
+	return size;
+}
 
-	int count = packets.size();
+int APCAP_RX::consume()
+{
+	rx_ring.consume();
+	return 0;
+}
 
-	pthread_mutex_unlock(&cs);
+int APCAP_RX::wait(int timeout)
+{
+	if (!init_ok)
+		return rx_ring.count();
 
-	return count;
+	doorbell->wait(timeout, ready_entry, this);
+	return rx_ring.count();
 }
 
 void* APCAP_RX::worker()
@@ -202,24 +308,49 @@ void* APCAP_RX::worker()
 				continue;
 			}
 
+			stats.packets_captured++;
 			if(ppcapPacketHeader->caplen != ppcapPacketHeader->len)
 			{
-				printf("cap len%d len %d\033[0m\n",ppcapPacketHeader->caplen, ppcapPacketHeader->len);
+				stats.packets_malformed++;
 				continue;
 			}
 
 			uint16_t uint16_tHeaderLen = (puint8_tPayload[2] + (puint8_tPayload[3] << 8)); //radio tap header length field
 			if (ppcapPacketHeader->len < (uint16_tHeaderLen + n80211HeaderLength))
 			{
-				printf("ppcapPacketHeader has less than expected header length\n");
+				stats.packets_malformed++;
 				continue;
 			}
 
+			// MAC signature and port, in case the kernel filter is not installed
+			const uint8_t *ieee = puint8_tPayload + uint16_tHeaderLen;
+			if (memcmp(ieee+10, uint8_taIeeeHeader+10, 5) != 0)
+			{
+				stats.packets_foreign++;
+				continue;
+			}
+
+			APCAP_RX_STREAM *stream = NULL;
+			if (ieee[15] != port)
+			{
+				for(int i=0; i<stream_count && !stream; i++)
+					if (streams[i]->port == ieee[15])
+						stream = streams[i];
+				if (!stream)
+				{
+					stats.packets_foreign++;
+					continue;
+				}
+			}
+
 			// retrive radiotap header fields
 			PENUMBRA_RADIOTAP_DATA prd;
 			struct ieee80211_radiotap_iterator rti;
 			if (ieee80211_radiotap_iterator_init(&rti,(struct ieee80211_radiotap_header *)puint8_tPayload,ppcapPacketHeader->len) < 0)
+			{
+				stats.packets_malformed++;
 				continue;
+			}
 
 			while (ieee80211_radiotap_iterator_next(&rti) == 0) {
 
@@ -254,39 +385,50 @@ void* APCAP_RX::worker()
 			if (prd.m_nRadiotapFlags & IEEE80211_RADIOTAP_F_FCS)
 				byte_count -= 4;
 
-			bool checksum_correct = (prd.m_nRadiotapFlags & IEEE80211_RADIOTAP_F_BADFCS) == 0;
+			int flags = 0;
+			if (prd.m_nRadiotapFlags & IEEE80211_RADIOTAP_F_BADFCS)
+			{
+				flags |= block_flag_bad_fcs;
+				stats.packets_bad_fcs++;
+			}
 
 			if (byte_count <= 0)
+			{
+				stats.packets_malformed++;
 				continue;
+			}
 
-			packet p;
-			p.size = byte_count;
-			memcpy(p.data, puint8_tPayload + uint16_tHeaderLen + n80211HeaderLength, byte_count);
-
-			pthread_mutex_lock(&cs);
-
-			if (p.size > 0)
+			// copy straight into the ring, the packet is dropped if the reader falls behind.
+			uint8_t *slot = NULL;
+			if (stream)
 			{
-				if (packets.size() > 1024)
-					packets.erase(packets.begin());
-				packets.push_back(p);
+				slot = stream->rx_ring.reserve(byte_count);
+				if (slot)
+				{
+					memcpy(slot, ieee + n80211HeaderLength, byte_count);
+					stream->rx_ring.commit(byte_count);
+					stream->doorbell->ring();
+				}
+			}
+			else
+			{
+				slot = rx_ring.reserve(byte_count);
+				if (slot)
+				{
+					memcpy(slot, ieee + n80211HeaderLength, byte_count);
+					rx_ring.commit(byte_count, flags);
+					doorbell->ring();
+				}
 			}
 
-			pthread_mutex_unlock(&cs);
-
-			static int i = 0;
-			//printf("\rRX:%d%s", i++, checksum_correct?"OK":"NK\n");
-			//if (!checksum_correct)
-			//	printf("NK\n");
-
-
-			byte_counter += byte_count;
-			static int64_t last_bandwidth = getus();
-			if(getus() - last_bandwidth > 1000000)
+			if (slot)
+			{
+				stats.packets_queued++;
+				stats.bytes_queued += byte_count;
+			}
+			else
 			{
-				last_bandwidth = getus();
-				//printf("%d bytes/s\n", byte_counter);
-				byte_counter = 0;
+				stats.packets_dropped++;
 			}
 		}
 	}
@@ -299,6 +441,13 @@ void* APCAP_RX::worker()
 APCAP_TX::APCAP_TX(const char *interface, int port)
 {
 	init_ok = false;
+	current_class = tx_class_video;
+	buffer_class = -1;
+
+	radiotap_tx_params params;
+	radiotap_default_tx_params(&params);
+	for(int i=0; i<tx_class_count; i++)
+		set_tx_params(i, &params);
 
 	char szErrbuf[PCAP_ERRBUF_SIZE] = {0};
 	ppcap = pcap_open_live(interface, 800, 1, 20, szErrbuf);
@@ -311,10 +460,9 @@ APCAP_TX::APCAP_TX(const char *interface, int port)
 		goto fail;
 	}
 
-	memcpy(packet_transmit_buffer, uint8_taRadiotapHeader, sizeof(uint8_taRadiotapHeader));
-	memcpy(packet_transmit_buffer+sizeof(uint8_taRadiotapHeader), uint8_taIeeeHeader, sizeof(uint8_taIeeeHeader));
-
-	printf("header=%d+%d bytes\n", sizeof(uint8_taRadiotapHeader), sizeof(uint8_taIeeeHeader));
+	memcpy(packet_transmit_buffer+RADIOTAP_TX_MAX_HEADER, uint8_taIeeeHeader, sizeof(uint8_taIeeeHeader));
+	packet_transmit_buffer[RADIOTAP_TX_MAX_HEADER+15] = radiotap_port_byte(port);		// address2
+	packet_transmit_buffer[RADIOTAP_TX_MAX_HEADER+21] = radiotap_port_byte(port);		// address3
 
 	pcap_setnonblock(ppcap, 0, szErrbuf);
 
@@ -329,23 +477,90 @@ APCAP_TX::~APCAP_TX()
 {
 }
 
+int APCAP_TX::set_tx_params(int tx_class, const radiotap_tx_params *params)
+{
+	if (tx_class < 0 || tx_class >= tx_class_count)
+		return -1;
+
+	uint8_t header[RADIOTAP_TX_MAX_HEADER];
+	int size = radiotap_build_tx_header(header, params);
+	if (size < 0)
+		return -1;
+
+	memcpy(class_header[tx_class], header, size);
+	class_header_size[tx_class] = size;
+	if (buffer_class == tx_class)
+		buffer_class = -1;
+
+	return 0;
+}
+
+int APCAP_TX::set_tx_class(int tx_class)
+{
+	if (tx_class < 0 || tx_class >= tx_class_count)
+		return -1;
+
+	current_class = tx_class;
+	return 0;
+}
+
+int APCAP_TX::ioctl(int op, void *p, int count)
+{
+	if (op != ioctl_set_tx_class || count < (int)sizeof(int))
+		return error_unsupported;
+
+	return set_tx_class(*(int*)p);
+}
+
 // write a block
 // class implementation is responsible for queueing blocks, or reject incoming blocks by returning an error.
 // returns num bytes written, negative values for error.
 int APCAP_TX::write(const void *buf, int block_size)
+{
+	block_segment segment = {buf, block_size};
+	int o = writev_class(current_class, &segment, 1);
+	return o < 0 ? o : 0;
+}
+
+int APCAP_TX::writev(const block_segment *segments, int segment_count)
+{
+	return writev_class(current_class, segments, segment_count);
+}
+
+int APCAP_TX::writev_class(int tx_class, const block_segment *segments, int segment_count)
 {
 	if (!init_ok)
 		return error_unsupported;
+	if (tx_class < 0 || tx_class >= tx_class_count)
+		return -1;
+
+	const int payload_offset = RADIOTAP_TX_MAX_HEADER + sizeof(uint8_taIeeeHeader);
+	int block_size = 0;
+	for(int i=0; i<segment_count; i++)
+	{
+		if (payload_offset + block_size + segments[i].size > MAX_PACKET_LENGTH)
+			return error_buffer_too_small;
 
-	memcpy(packet_transmit_buffer + sizeof(uint8_taRadiotapHeader) + sizeof(uint8_taIeeeHeader), buf, block_size);
-	int plen = sizeof(uint8_taRadiotapHeader) + sizeof(uint8_taIeeeHeader) + block_size;
-	int r = pcap_inject(ppcap, packet_transmit_buffer, plen);
-    if (r != plen) {
-        pcap_perror(ppcap, "Trouble injecting packet");
-        return -2;
-    }
+		memcpy(packet_transmit_buffer + payload_offset + block_size, segments[i].data, segments[i].size);
+		block_size += segments[i].size;
+	}
 
-	return 0;
+	int radiotap_size = class_header_size[tx_class];
+	uint8_t *packet = packet_transmit_buffer + RADIOTAP_TX_MAX_HEADER - radiotap_size;
+	if (buffer_class != tx_class)
+	{
+		memcpy(packet, class_header[tx_class], radiotap_size);
+		buffer_class = tx_class;
+	}
+
+	int plen = payload_offset + block_size - (packet - packet_transmit_buffer);
+	int r = pcap_inject(ppcap, packet, plen);
+	if (r != plen) {
+		pcap_perror(ppcap, "Trouble injecting packet");
+		return -2;
+	}
+
+	return block_size;
 }
 
 int APCAP_TX::read(void *buf, int max_block_size, bool remove/* = true*/)
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <stdint.h>
-#include <list>
 #include <HAL/Interface/IBlockDevice.h>
+#include <utils/packet_ring.h>
+#include <utils/doorbell.h>
+#include <utils/link_stats.h>
+#include "radiotap_tx.h"
 #include <pthread.h>
 #include <pcap/pcap.h>
 
@@ -10,19 +13,67 @@ namespace androidUAV
 {
 	// class for UDP block device.
 	const int MAX_PACKET_LENGTH = 4096;
-	typedef struct _packet
+	const int APCAP_RX_RING_SIZE = 256*1024;		// bytes, about 1000 FEC packets
+	const int APCAP_STREAM_RING_SIZE = 32*1024;		// bytes, queue of an extra port
+	const int APCAP_MAX_STREAMS = 4;
+
+	// APCAP_RX statistics record, counters since start.
+	typedef struct
+	{
+		stats_header header;
+		uint32_t packets_captured;		// frames pcap delivered
+		uint32_t packets_foreign;		// other MAC or port, normally stopped by the kernel filter
+		uint32_t packets_malformed;		// truncated or bad radiotap header
+		uint32_t packets_bad_fcs;		// queued anyway with HAL::block_flag_bad_fcs
+		uint32_t packets_queued;		// into the main ring or a stream
+		uint32_t packets_dropped;		// ring full, reader falling behind
+		uint32_t kernel_dropped;		// socket buffer overflow reported by pcap
+		uint32_t queue_depth;			// packets waiting in the rings now
+		int32_t rssi;					// latest, dbm
+		uint32_t reserved;
+		uint64_t bytes_queued;
+	} apcap_rx_stats;
+
+	class APCAP_RX;
+
+	// queue of one extra port of an APCAP_RX capture, see APCAP_RX::get_stream().
+	class APCAP_RX_STREAM : public HAL::IBlockDevice
 	{
-		int size;
-		uint8_t data[MAX_PACKET_LENGTH];
-	} packet;
+	public:
+		virtual int write(const void *buf, int block_size){return HAL::error_unsupported;}
+		virtual int read(void *buf, int max_block_size, bool remove = true);
+		virtual int available(){return rx_ring.count();}
+		int peek(const void **data);
+		int consume(){rx_ring.consume(); return 0;}
+		int wait(int timeout);
+		void set_doorbell(Doorbell *d){doorbell = d ? d : &own_doorbell;}
+		int get_port(){return port;}
+
+	protected:
+		friend class APCAP_RX;
+		APCAP_RX_STREAM(APCAP_RX *owner, int port);
+		~APCAP_RX_STREAM(){}
+
+		APCAP_RX *owner;
+		int port;
+		Doorbell own_doorbell;
+		Doorbell *doorbell;
+		PacketRing<APCAP_STREAM_RING_SIZE> rx_ring;
 
+		static int ready_entry(void *p);
+	};
 
 	class APCAP_RX : public HAL::IBlockDevice
 	{
 	public:
-		APCAP_RX(const char*interface = "wlan0", int port = 0);
+		// packets of port go to this device, packets of extra_ports to their own streams.
+		// all other frames are dropped by a kernel BPF filter.
+		APCAP_RX(const char*interface = "wlan0", int port = 0, const int *extra_ports = NULL, int extra_port_count = 0);
 		~APCAP_RX();
 
+		// the queue of an extra port given to the constructor, NULL if not captured.
+		APCAP_RX_STREAM *get_stream(int port);
+
 		// write a block
 		// class implementation is responsible for queueing blocks, or reject incoming blocks by returning an error.
 		// returns num bytes written, negative values for error.
@@ -35,33 +86,59 @@ namespace androidUAV
 		// query num available blocks in rx queue, negative values for error.
 		virtual int available();
 
+		// zero-copy read: returns size of the first block and points *data to it, error_no_more_blocks if empty.
+		// the block stays valid until consume(). *flags gets its HAL::block_flags if flags is not NULL.
+		int peek(const void **data, int *flags = NULL);
+		int consume();
+
+		// wait up to timeout(us) for incoming blocks, returns num available blocks, 0 on timeout.
+		int wait(int timeout);
+
+		// ring d instead of the device's own doorbell when blocks arrive,
+		// several devices sharing one doorbell can be waited on together. NULL to restore.
+		void set_doorbell(Doorbell *d){doorbell = d ? d : &own_doorbell;}
+
 		// return latest rssi in dbm.
 		int get_latest_rssi(){return latest_rssi;}
 
+		// HAL::ioctl_get_rssi, HAL::ioctl_get_block_flags
+		virtual int ioctl(int op, void *p, int count);
+
+		// statistics since start.
+		int get_stats(apcap_rx_stats *stats);
+
 	protected:
+		friend class APCAP_RX_STREAM;
 		bool worker_run;
 		pthread_t worker_thread;
-		pthread_mutex_t cs;
-		std::list<packet> packets;
+		Doorbell own_doorbell;
+		Doorbell *doorbell;
+		PacketRing<APCAP_RX_RING_SIZE> rx_ring;		// worker thread -> reader, single producer single consumer
 		bool init_ok;
+		int port;
+		APCAP_RX_STREAM *streams[APCAP_MAX_STREAMS];
+		int stream_count;
 		pcap_t *ppcap;
 		int n80211HeaderLength;
 		int selectable_fd;
 		int latest_rssi;
+		int last_read_flags;			// block_flags of the last read(), reader side
 
-		int guard[1024];
-		int byte_counter;
+		apcap_rx_stats stats;			// written by the worker thread only
 
 		int clearup();
+		int set_filter();
 
 		void* worker();
 		static void * worker_entry(void *p){return ((APCAP_RX*)p)->worker();}
+		static int ready_entry(void *p){return ((APCAP_RX*)p)->worker_run ? ((APCAP_RX*)p)->rx_ring.count() : -1;}
 
 	};
 
 	class APCAP_TX : public HAL::IBlockDevice
 	{
 	public:
+		// port: last byte of the MAC addresses, see APCAP_DEFAULT_PORT.
 		APCAP_TX(const char*interface, int port);
 		~APCAP_TX();
 
@@ -70,14 +147,37 @@ namespace androidUAV
 		// returns num bytes written, negative values for error.
 		virtual int write(const void *buf, int block_size);
 
+		// gather segments directly behind the radiotap/802.11 header, one copy per byte.
+		virtual int writev(const HAL::block_segment *segments, int segment_count);
+
+		// writev() with the radiotap parameters of tx_class.
+		int writev_class(int tx_class, const HAL::block_segment *segments, int segment_count);
+
 		virtual int read(void *buf, int max_block_size, bool remove = true);
 
 		// query num available blocks in rx queue, negative values for error.
 		virtual int available();
 
+		// radiotap parameters of a traffic class, used from the next write of that class.
+		// not synchronized with writes from other threads, configure before sending.
+		int set_tx_params(int tx_class, const radiotap_tx_params *params);
+
+		// traffic class of write()/writev(), tx_class_video by default.
+		int set_tx_class(int tx_class);
+
+		// HAL::ioctl_set_tx_class
+		virtual int ioctl(int op, void *p, int count);
+
 	protected:
 		bool init_ok;
 		pcap_t *ppcap;
+		int current_class;
+		uint8_t class_header[tx_class_count][RADIOTAP_TX_MAX_HEADER];
+		int class_header_size[tx_class_count];
+
+		// radiotap header of buffer_class right aligned before the 802.11 header at RADIOTAP_TX_MAX_HEADER,
+		// so payload offset is fixed and the header is copied only when the class changes.
+		int buffer_class;
 		uint8_t packet_transmit_buffer[MAX_PACKET_LENGTH];
 	};
 }
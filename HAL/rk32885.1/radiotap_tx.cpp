@@ -0,0 +1,85 @@
+#include "radiotap_tx.h"
+#include <string.h>
+#include "ieee80211_radiotap.h"
+
+// fields newer than our ieee80211_radiotap.h
+#define RADIOTAP_MCS 19
+#define RADIOTAP_MCS_HAVE_BW 0x01
+#define RADIOTAP_MCS_HAVE_MCS 0x02
+#define RADIOTAP_MCS_HAVE_GI 0x04
+#define RADIOTAP_MCS_BW_40 0x01
+#define RADIOTAP_MCS_SGI 0x04
+
+// injected frames are broadcast, don't wait for an ack and keep our sequence control field.
+#define RADIOTAP_TX_NOACK 0x0008
+#define RADIOTAP_TX_NOSEQ 0x0010
+
+namespace androidUAV
+{
+
+void radiotap_default_tx_params(radiotap_tx_params *params)
+{
+	params->rate = 0x22;
+	params->mcs = -1;
+	params->bw40 = false;
+	params->short_gi = false;
+	params->retries = -1;
+	params->tx_power = TX_POWER_DEFAULT;
+}
+
+int radiotap_build_tx_header(uint8_t *out, const radiotap_tx_params *params)
+{
+	if (params->mcs > 31 || (params->mcs < 0 && (params->rate <= 0 || params->rate > 255))
+		|| params->retries > 15 || (params->tx_power != TX_POWER_DEFAULT && (params->tx_power < -127 || params->tx_power > 127)))
+		return -1;
+
+	// fields must be in bit order, each aligned to its own size.
+	uint32_t present = 0;
+	int size = 8;
+	memset(out, 0, RADIOTAP_TX_MAX_HEADER);
+
+	if (params->mcs < 0)
+	{
+		present |= 1 << IEEE80211_RADIOTAP_RATE;
+		out[size++] = params->rate;
+	}
+
+	if (params->tx_power != TX_POWER_DEFAULT)
+	{
+		present |= 1 << IEEE80211_RADIOTAP_DBM_TX_POWER;
+		out[size++] = (int8_t)params->tx_power;
+	}
+
+	present |= 1 << IEEE80211_RADIOTAP_TX_FLAGS;
+	size = (size + 1) & ~1;
+	out[size++] = RADIOTAP_TX_NOACK | RADIOTAP_TX_NOSEQ;
+	out[size++] = 0;
+
+	if (params->retries >= 0)
+	{
+		present |= 1 << IEEE80211_RADIOTAP_DATA_RETRIES;
+		out[size++] = params->retries;
+	}
+
+	if (params->mcs >= 0)
+	{
+		present |= 1 << RADIOTAP_MCS;
+		out[size++] = RADIOTAP_MCS_HAVE_BW | RADIOTAP_MCS_HAVE_MCS | RADIOTAP_MCS_HAVE_GI;
+		out[size++] = (params->bw40 ? RADIOTAP_MCS_BW_40 : 0) | (params->short_gi ? RADIOTAP_MCS_SGI : 0);
+		out[size++] = params->mcs;
+	}
+
+	// version 0, length and present bitmap, little endian
+	out[0] = 0;
+	out[1] = 0;
+	out[2] = size & 0xff;
+	out[3] = size >> 8;
+	out[4] = present & 0xff;
+	out[5] = (present >> 8) & 0xff;
+	out[6] = (present >> 16) & 0xff;
+	out[7] = present >> 24;
+
+	return size;
+}
+
+}
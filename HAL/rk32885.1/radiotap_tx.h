@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace androidUAV
+{
+	// traffic classes of the monitor mode TX devices, each with its own radiotap parameters.
+	enum tx_class
+	{
+		tx_class_video = 0,			// FEC video packets, the default class
+		tx_class_control = 1,		// RC and control messages, robust low rate
+		tx_class_telemetry = 2,
+		tx_class_bulk = 3,
+		tx_class_count = 4,
+	};
+
+	// the port is the last byte of our 13:22:33:44:55:xx MAC addresses.
+	// port 0 selects APCAP_DEFAULT_PORT, the fixed MAC of older builds.
+	const int APCAP_DEFAULT_PORT = 0x66;
+	// YAL small messages and acks, see YAL/fec/message.h. one port per direction,
+	// a monitor mode capture sees its own injected frames and would take its own acks otherwise.
+	const int APCAP_MESSAGE_DOWNLINK_PORT = 0x67;		// aircraft to ground station
+	const int APCAP_MESSAGE_UPLINK_PORT = 0x68;			// ground station to aircraft
+	inline int radiotap_port_byte(int port){return port ? (port & 0xff) : APCAP_DEFAULT_PORT;}
+
+	const int TX_POWER_DEFAULT = -128;
+	const int RADIOTAP_TX_MAX_HEADER = 24;		// bytes, largest header radiotap_build_tx_header() builds
+	const int IEEE80211_TX_HEADER = 24;			// bytes, the data frame header behind it
+
+	typedef struct
+	{
+		int rate;					// legacy rate in 500kbps units, e.g. 12 = 6Mbps, 108 = 54Mbps
+		int mcs;					// HT MCS index 0~31, overrides rate. -1: legacy rate
+		bool bw40;					// HT 40MHz
+		bool short_gi;				// HT short guard interval
+		int retries;				// data retries, -1: driver default
+		int tx_power;				// dbm, TX_POWER_DEFAULT: driver default
+	} radiotap_tx_params;
+
+	// the parameters of the original static header: 0x22 rate, no ack, driver retries and power.
+	void radiotap_default_tx_params(radiotap_tx_params *params);
+
+	// build a radiotap TX header into out (RADIOTAP_TX_MAX_HEADER bytes), returns its size, negative for bad parameters.
+	int radiotap_build_tx_header(uint8_t *out, const radiotap_tx_params *params);
+}
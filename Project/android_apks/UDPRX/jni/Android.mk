@@ -25,6 +25,7 @@ LOCAL_SRC_FILES := \
 	$(FEC_PATH)/oRS.cpp \
 	$(FEC_PATH)/reciever.cpp \
 	$(FEC_PATH)/sender.cpp \
+	$(FEC_PATH)/redundancy.cpp \
 	udp_fec.cpp
 
 LOCAL_LDLIBS    := -llog
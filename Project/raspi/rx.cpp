@@ -4,8 +4,12 @@
 #include <unistd.h>
 #include <HAL/rk32885.1/Apcap.h>
 #include <YAL/fec/reciever.h>
+#include <YAL/fec/gf256.h>
+#include <YAL/fec/nal_packetizer.h>
 #include <YAL/fec/oRS.h>
 #include <YAL/fec/frame.h>
+#include <YAL/fec/frame_pool.h>
+#include <YAL/fec/message.h>
 #include <vector>
 #include <pthread.h>
 
@@ -13,53 +17,6 @@ using namespace androidUAV;
 using namespace std;
 int testRSSpeed();
 
-class cb : public IFrameReciever
-{
-public:
-	cb()
-	{
-		pthread_mutex_init(&_cs, NULL);
-	}
-	~cb()
-	{
-		pthread_mutex_destroy(&_cs);
-	}
-	int handle_event()
-	{
-		return 0;
-	}
-	int handle_frame(const frame &f)
-	{
- 		//printf("frame.v=%d, %d/%d bytes\n", f.integrality, *(int*)f.payload, f.payload_size);
-		frame * _frame = clone_frame(&f);
-
-		pthread_mutex_lock(&_cs);
-
-		frames.push_back(_frame);
-
-		pthread_mutex_unlock(&_cs);
-		return 0;
-	}
-	frame * get_frame()
-	{
-		pthread_mutex_lock(&_cs);
-
-		if (frames.size() == 0)
-		{
-			pthread_mutex_unlock(&_cs);
-			return NULL;
-		}
-
-		frame * f = frames[0];
-		frames.erase(frames.begin());
-
-		pthread_mutex_unlock(&_cs);
-
-		return f;
-	}
-	pthread_mutex_t _cs;
-	vector<frame*> frames;
-};
 
 static int64_t getus()
 {    
@@ -117,10 +74,26 @@ int main(int argc,char** argv)
 {
 //	testRSSpeed();
 
-	cb * frame_cache = new cb();
-	reciever *rec = new reciever(frame_cache);
-
-	APCAP_RX rx("wlan0", 0);
+	// FEC blocks and pictures live in preallocated pools, pictures go to the consumer without a copy.
+	FramePool *blocks = new FramePool(2, 255*MAX_PAYLOAD_SIZE);
+	FramePool *pictures = new FramePool(6, NAL_MAX_PICTURE_SIZE+4);
+	FrameQueue * frame_cache = new FrameQueue(pictures);
+	NalDepacketizer *depacketizer = new NalDepacketizer(frame_cache);
+	depacketizer->set_frame_allocator(pictures);
+	reciever *rec = new reciever(depacketizer);
+	rec->set_frame_allocator(blocks);
+	rec->set_low_latency(true);
+	rec->set_partial_output(true);
+	printf("fec kernels: %s\n", gf256_kernel_name());
+
+	const int message_port = APCAP_MESSAGE_DOWNLINK_PORT;
+	APCAP_RX rx("wlan0", 0, &message_port, 1);
+	APCAP_RX_STREAM *downlink_messages = rx.get_stream(APCAP_MESSAGE_DOWNLINK_PORT);
+	APCAP_TX uplink("wlan0", APCAP_MESSAGE_UPLINK_PORT);
+	uplink.set_tx_class(tx_class_control);
+	MessageLink link(NULL, &uplink);
+	int64_t last_report = getus();
+	int64_t last_idr_request = 0;
 
 	int64_t last_fps_show = getus();
 	int valid = 0;
@@ -128,6 +101,10 @@ int main(int argc,char** argv)
 	int wifi_byte_counter = 0;
 	int frame_byte_counter = 0;
 	int keyframe = 0;
+	apcap_rx_stats last_rx_stats;
+	reciever_stats last_rec_stats;
+	rx.get_stats(&last_rx_stats);
+	rec->get_stats(&last_rec_stats);
 
 	while(1)
 	{
@@ -143,21 +120,58 @@ int main(int argc,char** argv)
 			wifi_byte_counter = 0;
 			frame_byte_counter = 0;
 			keyframe = 0;
+
+			// per second link quality from the difference of two statistics records
+			apcap_rx_stats rx_stats;
+			reciever_stats rec_stats;
+			rx.get_stats(&rx_stats);
+			rec->get_stats(&rec_stats);
+			int frames = rec_stats.frames - last_rec_stats.frames;
+			latency_histogram latency;
+			for(int i=0; i<LATENCY_BUCKETS; i++)
+				latency.buckets[i] = rec_stats.assembly_latency.buckets[i] - last_rec_stats.assembly_latency.buckets[i];
+			fprintf(stderr, "link: %d pkts, %d dropped(%d kernel), %d/%d blocks lost(%d partial), %d recovered(%d data blocks), assembly p50/p99 %lld/%lldus\n",
+				rx_stats.packets_queued - last_rx_stats.packets_queued,
+				rx_stats.packets_dropped - last_rx_stats.packets_dropped, rx_stats.kernel_dropped - last_rx_stats.kernel_dropped,
+				rec_stats.frames_lost - last_rec_stats.frames_lost, frames, rec_stats.frames_partial - last_rec_stats.frames_partial,
+				rec_stats.frames_recovered - last_rec_stats.frames_recovered, rec_stats.blocks_recovered - last_rec_stats.blocks_recovered,
+				(long long)latency_histogram_percentile(&latency, 0.5f), (long long)latency_histogram_percentile(&latency, 0.99f));
+			last_rx_stats = rx_stats;
+			last_rec_stats = rec_stats;
+		}
+
+		// link statistics for the sender's redundancy controller
+		if (getus() > last_report + 200000)
+		{
+			last_report = getus();
+			link_report report;
+			rec->get_report(&report);
+			report.rssi = rx.get_latest_rssi();
+			link.send_time_critical(message_id_link_report, &report, sizeof(report));
+		}
+
+		// acks and messages from the air
+		const void *message;
+		int message_size;
+		while ((message_size = downlink_messages->peek(&message)) > 0)
+		{
+			link.put_packet(message, message_size);
+			downlink_messages->consume();
 		}
 
-		if (rx.available() == 0)
+		if (rx.wait(10000) == 0)
 		{
-			usleep(10000);
+			rec->check_timeout();
 			continue;
 		}
 
-		// feed reciever with pcap packets
-		uint8_t data[4096];
+		// feed reciever with pcap packets, straight out of the rx ring
+		const void *data;
 		int size = 0;
-		for(int i=rx.available(); i>0; i--)
+		while((size=rx.peek(&data)) > 0)
 		{
-			size=rx.read(data, 4096);
 			rec->put_packet(data, size);
+			rx.consume();
 			wifi_byte_counter += size;
 		}
 		
@@ -165,35 +179,47 @@ int main(int argc,char** argv)
 
 		frame * f = frame_cache->get_frame();
 		if (!f)
+			continue;
+
+		int frame_size = *(int*)f->payload;
+		uint8_t * frame_data = (uint8_t*)f->payload+4;
+
+		if (frame_size>f->payload_size-4)
 		{
-			usleep(10000);
+			frame_cache->release(f);
 			continue;
 		}
 
+		// damaged pictures still go to the decoder, it conceals the missing slices.
+		// the following pictures reference a damaged one, ask the air side for an IDR.
 		if (!f->integrality)
 		{
 			invalid ++;
-			release_frame(f);
-			continue;
+			if (getus() > last_idr_request + 500000)
+			{
+				last_idr_request = getus();
+				uint16_t picture_id = f->frame_id;
+				link.send_control(message_id_idr_request, &picture_id, sizeof(picture_id));
+			}
 		}
 
-		int frame_size = *(int*)f->payload;
-		uint8_t * frame_data = (uint8_t*)f->payload+4;
-
 		if (argc>1)
 		{
 			fwrite(frame_data, 1, frame_size, stdout );
 			fflush(stdout);
 		}
 
-		if (frame_size>f->payload_size-4)
+		if (!f->integrality)
+		{
+			frame_cache->release(f);
 			continue;
+		}
 
 		if ((frame_data[4] & 0x1f) == 7)
 			keyframe ++;
 		valid ++;
 		frame_byte_counter += f->payload_size;
-		release_frame(f);
+		frame_cache->release(f);
 	}
 
 	return 0;
@@ -22,6 +22,8 @@ LOCAL_SRC_FILES := \
 	../../../HAL/rk32885.1/AI2C.cpp \
 	../../../HAL/rk32885.1/AUDP.cpp \
 	../../../HAL/rk32885.1/Apcap.cpp \
+	../../../HAL/rk32885.1/ARawSocket.cpp \
+	../../../HAL/rk32885.1/radiotap_tx.cpp \
 	../../../HAL/rk32885.1/AVideo.cpp \
 	../../../HAL/rk32885.1/OV7740Control.cpp \
 	../../../modules/YAL/fec/GFMath.cpp \
@@ -30,9 +32,15 @@ LOCAL_SRC_FILES := \
 	../../../modules/YAL/fec/oRS.cpp \
 	../../../modules/YAL/fec/reciever.cpp \
 	../../../modules/YAL/fec/cauchy_256.cpp \
+	../../../modules/YAL/fec/cauchy_gf256.cpp \
+	../../../modules/YAL/fec/gf256.cpp \
 	../../../modules/YAL/fec/MemSwap.cpp \
 	../../../modules/YAL/fec/MemXOR.cpp \
 	../../../modules/YAL/fec/sender.cpp \
+	../../../modules/YAL/fec/redundancy.cpp \
+	../../../modules/YAL/fec/message.cpp \
+	../../../modules/YAL/fec/async_sender.cpp \
+	../../../modules/YAL/fec/nal_packetizer.cpp \
 	../../../modules/utils/param.cpp \
 	../../../modules/utils/space.cpp \
 	../../../modules/utils/gauss_newton.cpp \
@@ -41,6 +49,10 @@ LOCAL_SRC_FILES := \
 	../../../modules/utils/ymodem.cpp \
 	../../../modules/utils/SEGGER_RTT.c \
 	../../../modules/utils/log_android.cpp \
+	../../../modules/utils/log_block.cpp \
+	../../../modules/utils/log_drop.cpp \
+	../../../modules/utils/imu_capture.cpp \
+	../../../modules/utils/minilzo.c \
 	../../../modules/Algorithm/pos_controll.cpp \
 	../../../modules/Algorithm/pos_controll_old.cpp \
 	../../../modules/Algorithm/pos_estimator.cpp \
@@ -117,7 +117,7 @@ namespace sensors
 			{
 				cc->unlockBuffer(lb);
 				*pp = lb2.data;
-				add_table(*pp, lb);
+				add_table(*pp, lb2);
 				return 0;
 			}
 			else
@@ -179,6 +179,41 @@ namespace sensors
 		return NULL;
 	}
 
+	int RK3288Camera51::get_planes(uint8_t *p, yuv_planes *planes)
+	{
+		CpuConsumer::LockedBuffer *lb = find_table(p);
+		if (!lb || !planes)
+			return -1;
+
+		planes->y = lb->data;
+		planes->y_stride = lb->stride;
+		planes->width = lb->width;
+		planes->height = lb->height;
+
+		// flexible YUV buffers describe their chroma planes,
+		// YV12 ones follow the android layout: Y, Cr, Cb, chroma stride aligned to 16 bytes.
+		if (lb->dataCb && lb->dataCr)
+		{
+			planes->u = lb->dataCb;
+			planes->v = lb->dataCr;
+			planes->uv_stride = lb->chromaStride;
+			planes->uv_step = lb->chromaStep;
+		}
+		else if (lb->format == HAL_PIXEL_FORMAT_YV12)
+		{
+			planes->uv_stride = (lb->stride/2 + 15) & ~15;
+			planes->uv_step = 1;
+			planes->v = lb->data + lb->stride * lb->height;
+			planes->u = planes->v + planes->uv_stride * (lb->height/2);
+		}
+		else
+		{
+			return -1;
+		}
+
+		return 0;
+	}
+
 	// get current frame format
 	int RK3288Camera51::get_frame_format(devices::frame_format *format)
 	{
@@ -17,6 +17,19 @@
 
 namespace sensors
 {
+	// plane layout of a YUV 4:2:0 frame, planar (uv_step 1) or semi planar (uv_step 2).
+	typedef struct
+	{
+		uint8_t *y;
+		uint8_t *u;
+		uint8_t *v;
+		int y_stride;
+		int uv_stride;
+		int uv_step;
+		int width;
+		int height;
+	} yuv_planes;
+
 	class RK3288Camera51 : public devices::ICamera
 	{
 	public:
@@ -35,6 +48,10 @@ namespace sensors
 		// release one frame and add it back to camera's internal queue
 		virtual int release_frame(uint8_t *p);
 
+		// plane layout of a frame from get_frame(), it stays valid until release_frame().
+		// lets a consumer read the camera buffer directly instead of copying it out first.
+		int get_planes(uint8_t *p, yuv_planes *planes);
+
 		// get current frame format
 		virtual int get_frame_format(devices::frame_format *format);
 
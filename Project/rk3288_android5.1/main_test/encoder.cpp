@@ -110,6 +110,11 @@ int android_video_encoder::encode_next_frame()
 	return err;
 }
 
+int android_video_encoder::request_idr()
+{
+	return codec->requestIDRFrame();
+}
+
 int android_video_encoder::get_encoded_frame(uint8_t **pp)
 {
 	if (!pp)
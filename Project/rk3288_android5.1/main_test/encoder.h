@@ -19,6 +19,9 @@ public:
 	int encode_next_frame();
 	int get_encoded_frame(uint8_t **pp);
 
+	// make one of the next frames an IDR.
+	int request_idr();
+
 protected:
 	android::sp<android::MediaCodec> codec;
 	android::Vector<android::sp<android::ABuffer> > inputBuffers;
@@ -3,7 +3,9 @@
 #include "encoder.h"
 #include <libyuv.h>
 #include "myx264.h"
-#include <YAL/fec/sender.h>
+#include <YAL/fec/async_sender.h>
+#include <YAL/fec/nal_packetizer.h>
+#include <YAL/fec/message.h>
 
 using namespace sensors;
 using namespace devices;
@@ -17,20 +19,92 @@ static int64_t getus()
 
 
 #include <HAL/rk32885.1/Apcap.h>
+#include <HAL/rk32885.1/ARawSocket.h>
 using namespace androidUAV;
 
+// a camera frame straight into an I420 encoder input buffer in one pass, no intermediate copy:
+// centre crop to the encoder's aspect ratio, scale if the sizes still differ, chroma reordered on the way.
+static int camera_to_i420(const yuv_planes *src, uint8_t *dst, int width, int height)
+{
+	int crop_w = src->width;
+	int crop_h = src->height;
+	if (crop_w * height > crop_h * width)
+		crop_w = crop_h * width / height;
+	else
+		crop_h = crop_w * height / width;
+	crop_w &= ~1;
+	crop_h &= ~1;
+	int x = ((src->width - crop_w) / 2) & ~1;
+	int y = ((src->height - crop_h) / 2) & ~1;
+
+	const uint8_t *src_y = src->y + y * src->y_stride + x;
+	const uint8_t *src_u = src->u + y/2 * src->uv_stride + x/2 * src->uv_step;
+	const uint8_t *src_v = src->v + y/2 * src->uv_stride + x/2 * src->uv_step;
+	uint8_t *dst_y = dst;
+	uint8_t *dst_u = dst + width * height;
+	uint8_t *dst_v = dst_u + width * height / 4;
+
+	if (crop_w == width && crop_h == height)
+		return libyuv::Android420ToI420(src_y, src->y_stride, src_u, src->uv_stride, src_v, src->uv_stride, src->uv_step,
+			dst_y, width, dst_u, width/2, dst_v, width/2, width, height);
+
+	// the scaler reads planar chroma only
+	if (src->uv_step != 1)
+		return -1;
+
+	return libyuv::I420Scale(src_y, src->y_stride, src_u, src->uv_stride, src_v, src->uv_stride, crop_w, crop_h,
+		dst_y, width, dst_u, width/2, dst_v, width/2, width, height, libyuv::kFilterBilinear);
+}
+
+// messages from the ground station
+class uplink_handler : public IMessageHandler
+{
+public:
+	uplink_handler(RedundancyController *redundancy, android_video_encoder *enc):redundancy(redundancy), enc(enc), last_idr_request(0){}
+	int handle_message(int type, int id, const void *data, int size)
+	{
+		if (id == message_id_link_report && size == sizeof(link_report))
+			redundancy->feed_report((const link_report*)data);
+
+		// the ground station lost part of a picture, its decoder conceals until the next IDR.
+		// requests of the same loss arrive in a burst, one IDR answers them all.
+		if (id == message_id_idr_request && getus() > last_idr_request + 200000)
+		{
+			last_idr_request = getus();
+			enc->request_idr();
+		}
+		return 0;
+	}
+
+protected:
+	RedundancyController *redundancy;
+	android_video_encoder *enc;
+	int64_t last_idr_request;
+};
+
 int test_pcap_block_device()
 {	
 	printf("test_pcap_block_device\n");
 
 
-	APCAP_TX tx("wlan0", 0);
-	FrameSender sender;
-	sender.set_block_device(&tx);
+	ARAWSOCK_TX tx("wlan0", 0);
+	ARAWSOCK_TX message_tx("wlan0", APCAP_MESSAGE_DOWNLINK_PORT);
+	message_tx.set_tx_class(tx_class_control);
+	MessageLink link(&tx, &message_tx);
+	link.set_video_rate(500000, 16384);		// keep the driver queue short, messages overtake IDR bursts
+	AsyncFrameSender sender(4, policy_drop_oldest);
+	sender.set_block_device(link.video_device());
+	APCAP_RX uplink("wlan0", APCAP_MESSAGE_UPLINK_PORT);
+	RedundancyController redundancy;
+	sender.set_redundancy_controller(&redundancy);
+	sender.set_long_block(3, 35000, 6);		// 250kbps P-frames are only a few packets, protect them together
+	NalPacketizer packetizer(&sender);
 
 	printf("31\n");
 	android_video_encoder enc;
 	enc.init(640, 360, 250000);
+	uplink_handler handler(&redundancy, &enc);
+	link.set_handler(&handler);
 	for(int i=0; i<10; i++)
 	{
 		uint8_t *ooo = NULL;
@@ -48,9 +122,6 @@ int test_pcap_block_device()
 	printf("33\n");
 	x264 enc_soft;
 	enc_soft.init(640, 360, 250);
-	uint8_t * yv12 = new uint8_t[640*480*3/2];
-	memset(yv12, 0x80, 640*480*3/2);	// grey, UV=0x80=neutual
-	uint8_t * frame_with_size = new uint8_t[1024*1024]; 	// 1Mbyte ought to be enough
 
 	FILE * f = fopen("/data/on.h264", "wb");
 
@@ -59,6 +130,15 @@ int test_pcap_block_device()
 	int64_t t = getus();
 	while(1)
 	{
+		// messages from ground station
+		const void *message;
+		int message_size;
+		while ((message_size = uplink.peek(&message)) > 0)
+		{
+			link.put_packet(message, message_size);
+			uplink.consume();
+		}
+
 		// drain live streaming
 		uint8_t *ooo = NULL;
 		int encoded_size = enc.get_encoded_frame(&ooo);
@@ -67,31 +147,28 @@ int test_pcap_block_device()
 			int nal_type = ooo[4] & 0x1f;
 
 			//printf("live streaming: %d, %d\n", encoded_size, nal_type);
-			memcpy(frame_with_size+4, ooo, encoded_size);
-			*(int*)frame_with_size = encoded_size;
-			sender.send_frame(frame_with_size, encoded_size+4);			
+			packetizer.send_picture(ooo, encoded_size);
 		}
+		sender.poll();
 
 		// capture new frames
 		uint8_t *p = NULL;
 		int s = c.get_frame(&p);
 		if (s == 0)
 		{
-			// got frame, copy it out
+			// got frame
 			if (frame_count == 0)
 				t = getus();
 			printf("frame:%d, %dfps\n", frame_count, int64_t(frame_count)*1000000/(getus()-t));
 			frame_count++;
-			memcpy(yv12, p, 640*360);
-			c.release_frame(p);
 
-			// feed live streaming encoder
+			// feed live streaming encoder, converted from the camera buffer in place.
+			// the input buffer stays ours until encode_next_frame() if the conversion fails.
+			yuv_planes planes;
 			void *live = enc.get_next_input_frame_pointer();
-			if (live)
-			{
-				memcpy(live, yv12, 640*360*3/2);
+			if (live && c.get_planes(p, &planes) == 0 && camera_to_i420(&planes, (uint8_t*)live, 640, 360) == 0)
 				enc.encode_next_frame();
-			}
+			c.release_frame(p);
 		}
 		else
 		{
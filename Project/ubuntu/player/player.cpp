@@ -1,104 +1,220 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <HAL/rk32885.1/Apcap.h>
 #include <YAL/fec/reciever.h>
+#include <YAL/fec/nal_packetizer.h>
 #include <YAL/fec/frame.h>
+#include <YAL/fec/frame_pool.h>
+#include <YAL/fec/message.h>
 #include <SDL2/SDL.h>
-#include <vector>
 #include <pthread.h>
 
 extern "C"
 {
-#include <libavcodec/avcodec.h>	
+#include <libavcodec/avcodec.h>
 }
 
 using namespace androidUAV;
-using namespace std;
+
+// three stage pipeline, so a slow stage never stalls the ones before it:
+//   capture thread: drains pcap into the FEC reciever, pictures go to a FrameQueue (dropped if decoding falls behind).
+//                   partially received pictures are kept, the decoder conceals them and an IDR is requested over the uplink.
+//   decode thread: libavcodec with slice threads and low delay flags, decoded pictures go to a one slot mailbox.
+//   main thread: SDL events and rendering, shows the latest decoded picture at the next vsync.
 
 int screen_w = 640;
 int screen_h = 360;
-const int pixel_w = 640;
-const int pixel_h = 360;
-uint32_t pixformat= SDL_PIXELFORMAT_IYUV;
-uint8_t buffer[pixel_w*pixel_h*2] = {0};
-const int INBUF_SIZE = 4096000;
-uint8_t inbuf[INBUF_SIZE + FF_INPUT_BUFFER_PADDING_SIZE];
-
 
 static int64_t getus()
-{    
-   struct timespec tv;  
-   clock_gettime(CLOCK_MONOTONIC, &tv);    
-   return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec/1000;    
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec/1000;
 }
 
-class cb : public IFrameReciever
+typedef struct
 {
-public:
-	cb()
-	{
-		pthread_mutex_init(&_cs, NULL);
-	}
-	~cb()
-	{
-		pthread_mutex_destroy(&_cs);
-	}
-	int handle_event()
+	bool run;
+	APCAP_RX *rx;
+	APCAP_RX_STREAM *downlink_messages;
+	MessageLink *link;
+	reciever *rec;
+	FrameQueue *pictures;
+	AVCodecContext *codec;
+	FILE *h264;
+
+	// mailbox: newest decoded picture not rendered yet, under cs
+	pthread_mutex_t cs;
+	pthread_cond_t decoded;
+	AVFrame *pending;
+	bool has_pending;
+
+	// counters since last print
+	int decoded_count;
+	int skipped_count;			// decoded but replaced before rendering
+	int rendered_count;
+	int damaged_count;			// decoded with concealment
+} player_state;
+
+static void *capture_thread(void *p)
+{
+	player_state *s = (player_state*)p;
+	while(s->run)
 	{
-		return 0;
+		// feed reciever with pcap packets, straight out of the rx ring
+		s->rx->wait(10000);
+		const void *data;
+		int size = 0;
+		while((size=s->rx->peek(&data)) > 0)
+		{
+			s->rec->put_packet(data, size);
+			s->rx->consume();
+		}
+		s->rec->check_timeout();
+
+		// acks of IDR requests
+		while((size=s->downlink_messages->peek(&data)) > 0)
+		{
+			s->link->put_packet(data, size);
+			s->downlink_messages->consume();
+		}
 	}
-	int handle_frame(const frame &f)
-	{
- 		//printf("frame.v=%d, %d/%d bytes\n", f.integrality, *(int*)f.payload, f.payload_size);
-		frame * _frame = clone_frame(&f);
 
-		pthread_mutex_lock(&_cs);
+	return 0;
+}
 
-		frames.push_back(_frame);
+static void *decode_thread(void *p)
+{
+	player_state *s = (player_state*)p;
+	AVFrame *picture = av_frame_alloc();
+	AVPacket avpkt;
+	av_init_packet(&avpkt);
+	int64_t last_idr_request = 0;
 
-		pthread_mutex_unlock(&_cs);
-		return 0;
-	}
-	frame * get_frame()
+	while(s->run)
 	{
-		pthread_mutex_lock(&_cs);
+		if (s->pictures->wait(10000) == 0)
+			continue;
+
+		frame * f = s->pictures->get_frame();
+		if (!f)
+			continue;
+
+		int size = *(int*)f->payload;
+		if (size > f->payload_size-4)
+		{
+			s->pictures->release(f);
+			continue;
+		}
 
-		if (frames.size() == 0)
+		// damaged pictures are decoded too, the decoder conceals the missing slices instead of freezing.
+		// the following pictures reference a damaged one, ask the air side for an IDR.
+		if (!f->integrality)
 		{
-			pthread_mutex_unlock(&_cs);
-			return NULL;
+			pthread_mutex_lock(&s->cs);
+			s->damaged_count++;
+			pthread_mutex_unlock(&s->cs);
+			if (getus() > last_idr_request + 500000)
+			{
+				last_idr_request = getus();
+				uint16_t picture_id = f->frame_id;
+				s->link->send_control(message_id_idr_request, &picture_id, sizeof(picture_id));
+			}
 		}
 
-		frame * f = frames[0];
-		frames.erase(frames.begin());
+		// the pool frame has room behind the picture for the padding libavcodec reads over.
+		avpkt.size = size;
+		avpkt.data = (uint8_t*)f->payload+4;
+		memset(avpkt.data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
 
-		pthread_mutex_unlock(&_cs);
+		if (s->h264)
+			fwrite(avpkt.data, 1, avpkt.size, s->h264);
 
-		return f;
+		while (avpkt.size > 0)
+		{
+			int got_picture = 0;
+			int len = avcodec_decode_video2(s->codec, picture, &got_picture, &avpkt);
+			if (len < 0)
+			{
+				fprintf(stderr, "Error while decoding frame %d\n", f->frame_id);
+				break;
+			}
+			if (got_picture)
+			{
+				// latest picture wins, the render thread never works through a backlog.
+				pthread_mutex_lock(&s->cs);
+				if (s->has_pending)
+				{
+					av_frame_unref(s->pending);
+					s->skipped_count++;
+				}
+				av_frame_move_ref(s->pending, picture);
+				s->has_pending = true;
+				s->decoded_count++;
+				pthread_cond_signal(&s->decoded);
+				pthread_mutex_unlock(&s->cs);
+			}
+			avpkt.size -= len;
+			avpkt.data += len;
+		}
+
+		s->pictures->release(f);
 	}
-	pthread_mutex_t _cs;
-	vector<frame*> frames;
-};
 
+	av_frame_free(&picture);
+	return 0;
+}
+
+// take the pending picture, waiting up to timeout(us). NULL on timeout.
+static AVFrame *take_picture(player_state *s, AVFrame *out, int timeout)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	int64_t ns = deadline.tv_nsec + (int64_t)timeout * 1000;
+	deadline.tv_sec += ns / 1000000000;
+	deadline.tv_nsec = ns % 1000000000;
+
+	pthread_mutex_lock(&s->cs);
+	while (!s->has_pending && s->run)
+	{
+		if (pthread_cond_timedwait(&s->decoded, &s->cs, &deadline) == ETIMEDOUT)
+			break;
+	}
+	bool got = s->has_pending;
+	if (got)
+	{
+		av_frame_move_ref(out, s->pending);
+		s->has_pending = false;
+	}
+	pthread_mutex_unlock(&s->cs);
+
+	return got ? out : NULL;
+}
 
 int main(int argc,char** argv)
 {
 	avcodec_register_all();
 	AVCodec * codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-    AVFrame *picture = av_frame_alloc();
-    AVCodecContext *c = avcodec_alloc_context3(codec);
-    if(codec->capabilities&CODEC_CAP_TRUNCATED)
-    	c->flags|= CODEC_FLAG_TRUNCATED; /* we do not send complete frames */
-    c->thread_count = 1;
-    if (avcodec_open2(c, codec, NULL) < 0) {
-        fprintf(stderr, "could not open codec\n");
-        exit(1);
-    }
-
-
-
+	AVCodecContext *c = avcodec_alloc_context3(codec);
+
+	// complete access units come out of NalDepacketizer, so no truncated stream parsing.
+	// low delay: output every picture as soon as it is decoded, no reordering delay.
+	// slice threads decode one picture in parallel, frame threads would add a frame of latency per thread.
+	c->flags |= CODEC_FLAG_LOW_DELAY;
+	c->flags2 |= CODEC_FLAG2_FAST;
+	c->thread_type = FF_THREAD_SLICE;
+	c->thread_count = 0;		// auto, one per core
+	c->refcounted_frames = 1;	// decoded pictures are handed to the render thread
+	c->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK;
+	c->flags2 |= CODEC_FLAG2_SHOW_ALL;	// show concealed pictures before the first IDR too
+	if (avcodec_open2(c, codec, NULL) < 0) {
+		fprintf(stderr, "could not open codec\n");
+		exit(1);
+	}
 
 	if(SDL_Init(SDL_INIT_VIDEO)) {
 		printf( "Could not initialize SDL - %s\n", SDL_GetError());
@@ -112,103 +228,125 @@ int main(int argc,char** argv)
 		return -1;
 	}
 
-	SDL_Renderer* sdlRenderer = SDL_CreateRenderer(screen, -1, 0);
-	SDL_Texture* sdlTexture = SDL_CreateTexture(sdlRenderer,pixformat, SDL_TEXTUREACCESS_STREAMING,pixel_w,pixel_h);
-
-
-	cb * frame_cache = new cb();
-	reciever *rec = new reciever(frame_cache);
-
-	APCAP_RX rx("wlan0", 0);
-
-	memset(buffer, 0x80, sizeof(buffer));
-	AVPacket avpkt;
-	av_init_packet(&avpkt);
-	FILE *h264 = fopen("out.h264", "wb");
-	while(1)
+	// vsync paces presentation to the display, a late picture waits for the next refresh instead of tearing.
+	SDL_Renderer* sdlRenderer = SDL_CreateRenderer(screen, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+	SDL_Texture* sdlTexture = NULL;
+	int texture_w = 0;
+	int texture_h = 0;
+
+	// FEC blocks and pictures live in preallocated pools, pictures go to the consumer without a copy.
+	FramePool *blocks = new FramePool(2, 255*MAX_PAYLOAD_SIZE);
+	FramePool *pictures = new FramePool(6, NAL_MAX_PICTURE_SIZE+4+FF_INPUT_BUFFER_PADDING_SIZE);
+	FrameQueue * frame_cache = new FrameQueue(pictures);
+	NalDepacketizer *depacketizer = new NalDepacketizer(frame_cache);
+	depacketizer->set_frame_allocator(pictures);
+	reciever *rec = new reciever(depacketizer);
+	rec->set_frame_allocator(blocks);
+	rec->set_low_latency(true);
+	rec->set_partial_output(true);
+
+	const int message_port = APCAP_MESSAGE_DOWNLINK_PORT;
+	APCAP_RX rx("wlan0", 0, &message_port, 1);
+	APCAP_TX uplink("wlan0", APCAP_MESSAGE_UPLINK_PORT);
+	uplink.set_tx_class(tx_class_control);
+	MessageLink link(NULL, &uplink);
+
+	player_state s;
+	s.run = true;
+	s.rx = &rx;
+	s.downlink_messages = rx.get_stream(APCAP_MESSAGE_DOWNLINK_PORT);
+	s.link = &link;
+	s.rec = rec;
+	s.pictures = frame_cache;
+	s.codec = c;
+	s.h264 = fopen("out.h264", "wb");
+	pthread_mutex_init(&s.cs, NULL);
+	pthread_cond_init(&s.decoded, NULL);
+	s.pending = av_frame_alloc();
+	s.has_pending = false;
+	s.decoded_count = 0;
+	s.skipped_count = 0;
+	s.rendered_count = 0;
+	s.damaged_count = 0;
+
+	pthread_t capture;
+	pthread_t decode;
+	pthread_create(&capture, NULL, capture_thread, &s);
+	pthread_create(&decode, NULL, decode_thread, &s);
+
+	AVFrame *shown = av_frame_alloc();
+	int64_t last_fps_show = getus();
+	int last_dropped = 0;
+	apcap_rx_stats last_rx_stats;
+	rx.get_stats(&last_rx_stats);
+	while(s.run)
 	{
 		SDL_Event event;
-		event.type = 0;
-		SDL_PollEvent(&event);
-
-		if(event.type==SDL_WINDOWEVENT)
-			SDL_GetWindowSize(screen,&screen_w,&screen_h);
-		else if(event.type==SDL_QUIT)
-			break;
-		else
+		while (SDL_PollEvent(&event))
 		{
-			// feed reciever with pcap packets
-			uint8_t data[4096];
-			int size = 0;
-			while((size=rx.read(data, 4096)) > 0)
-			{
-				//printf("\r%d", i++);
-				//fflush(stdout);
-				rec->put_packet(data, size);
-			}
-
-			static int64_t last_fps_show = getus();
-			if (getus() > last_fps_show + 1000000)
-			{
-				last_fps_show = getus();
-				fprintf(stderr, "%ddbm\n", rx.get_latest_rssi());
-			}
-
-			frame * f = frame_cache->get_frame();
-			if (!f)
-			{
-				usleep(10000);
-				continue;
-			}
-
-			if (!f->integrality)
-			{
-				release_frame(f);
-				continue;
-			}
-
-			avpkt.size = *(int*)f->payload;
-			avpkt.data = (uint8_t*)f->payload+4;
+			if(event.type==SDL_WINDOWEVENT)
+				SDL_GetWindowSize(screen,&screen_w,&screen_h);
+			else if(event.type==SDL_QUIT)
+				s.run = false;
+		}
 
-			if (avpkt.size>f->payload_size-4)
-				continue;
+		if (getus() > last_fps_show + 1000000)
+		{
+			last_fps_show = getus();
+			apcap_rx_stats rx_stats;
+			rx.get_stats(&rx_stats);
+			pthread_mutex_lock(&s.cs);
+			fprintf(stderr, "%ddbm, %d packets dropped, %d decoded(%d damaged), %d rendered, %d skipped, %d dropped before decoding\n", rx_stats.rssi,
+				rx_stats.packets_dropped - last_rx_stats.packets_dropped,
+				s.decoded_count, s.damaged_count, s.rendered_count, s.skipped_count, frame_cache->dropped_frames() - last_dropped);
+			s.decoded_count = 0;
+			s.skipped_count = 0;
+			s.rendered_count = 0;
+			s.damaged_count = 0;
+			pthread_mutex_unlock(&s.cs);
+			last_dropped = frame_cache->dropped_frames();
+			last_rx_stats = rx_stats;
+		}
 
-			fwrite(avpkt.data, 1, avpkt.size, h264);
+		// short timeout, SDL events are handled on this thread too.
+		if (!take_picture(&s, shown, 10000))
+			continue;
 
-			while (avpkt.size > 0) 
-			{
-				static int frame = 0;
-				int got_picture = 0;
-	            int len = avcodec_decode_video2(c, picture, &got_picture, &avpkt);
-	            if (len < 0) {
-	                fprintf(stderr, "Error while decoding frame %d\n", frame);
-	                break;
-	            }
-	            if (got_picture) {
-	                //printf("showing frame %3d\n", frame);
-	                //fflush(stdout);
-
-					//show_picture(picture);
-					SDL_Rect sdlRect = {0, 0, screen_w, screen_h};
-					memcpy(buffer, picture->data[0], pixel_w*pixel_h);
-					//memcpy(buffer+pixel_w*pixel_h, picture->data[1], pixel_w*pixel_h/4);
-					//memcpy(buffer+pixel_w*pixel_h*5/4, picture->data[2], pixel_w*pixel_h/4);
-
-					SDL_UpdateTexture( sdlTexture, NULL, buffer, pixel_w);
-					SDL_RenderClear( sdlRenderer );
-					SDL_RenderCopy( sdlRenderer, sdlTexture, NULL, &sdlRect);
-					SDL_RenderPresent( sdlRenderer );
-
-					frame++;
-	            }
-	            avpkt.size -= len;
-	            avpkt.data += len;
-	        }
-
-	        release_frame(f);
+		if (!sdlTexture || texture_w != shown->width || texture_h != shown->height)
+		{
+			if (sdlTexture)
+				SDL_DestroyTexture(sdlTexture);
+			texture_w = shown->width;
+			texture_h = shown->height;
+			sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, texture_w, texture_h);
 		}
+
+		// upload straight from the decoder's planes, no intermediate copy.
+		SDL_Rect sdlRect = {0, 0, screen_w, screen_h};
+		SDL_UpdateYUVTexture(sdlTexture, NULL, shown->data[0], shown->linesize[0],
+			shown->data[1], shown->linesize[1], shown->data[2], shown->linesize[2]);
+		av_frame_unref(shown);
+		SDL_RenderClear( sdlRenderer );
+		SDL_RenderCopy( sdlRenderer, sdlTexture, NULL, &sdlRect);
+		SDL_RenderPresent( sdlRenderer );
+
+		pthread_mutex_lock(&s.cs);
+		s.rendered_count++;
+		pthread_mutex_unlock(&s.cs);
 	}
 
+	pthread_mutex_lock(&s.cs);
+	pthread_cond_broadcast(&s.decoded);
+	pthread_mutex_unlock(&s.cs);
+	pthread_join(capture, NULL);
+	pthread_join(decode, NULL);
+
+	av_frame_free(&shown);
+	av_frame_free(&s.pending);
+	avcodec_close(c);
+	if (s.h264)
+		fclose(s.h264);
+
 	SDL_Quit();
 
 	return 0;
@@ -4,60 +4,16 @@
 #include <unistd.h>
 #include <HAL/rk32885.1/Apcap.h>
 #include <YAL/fec/reciever.h>
+#include <YAL/fec/diversity.h>
+#include <YAL/fec/nal_packetizer.h>
 #include <YAL/fec/frame.h>
+#include <YAL/fec/frame_pool.h>
 #include <vector>
 #include <pthread.h>
 
 using namespace androidUAV;
 using namespace std;
 
-class cb : public IFrameReciever
-{
-public:
-	cb()
-	{
-		pthread_mutex_init(&_cs, NULL);
-	}
-	~cb()
-	{
-		pthread_mutex_destroy(&_cs);
-	}
-	int handle_event()
-	{
-		return 0;
-	}
-	int handle_frame(const frame &f)
-	{
- 		//printf("frame.v=%d, %d/%d bytes\n", f.integrality, *(int*)f.payload, f.payload_size);
-		frame * _frame = clone_frame(&f);
-
-		pthread_mutex_lock(&_cs);
-
-		frames.push_back(_frame);
-
-		pthread_mutex_unlock(&_cs);
-		return 0;
-	}
-	frame * get_frame()
-	{
-		pthread_mutex_lock(&_cs);
-
-		if (frames.size() == 0)
-		{
-			pthread_mutex_unlock(&_cs);
-			return NULL;
-		}
-
-		frame * f = frames[0];
-		frames.erase(frames.begin());
-
-		pthread_mutex_unlock(&_cs);
-
-		return f;
-	}
-	pthread_mutex_t _cs;
-	vector<frame*> frames;
-};
 
 static int64_t getus()
 {    
@@ -68,15 +24,30 @@ static int64_t getus()
 
 int main(int argc,char** argv)
 {
-	cb * frame_cache = new cb();
-	reciever *rec = new reciever(frame_cache);
-
-	APCAP_RX rx("wlan0", 0);
+	// FEC blocks and pictures live in preallocated pools, pictures go to the consumer without a copy.
+	FramePool *blocks = new FramePool(2, 255*MAX_PAYLOAD_SIZE);
+	FramePool *pictures = new FramePool(6, NAL_MAX_PICTURE_SIZE+4);
+	FrameQueue * frame_cache = new FrameQueue(pictures);
+	NalDepacketizer *depacketizer = new NalDepacketizer(frame_cache);
+	depacketizer->set_frame_allocator(pictures);
+	reciever *rec = new reciever(depacketizer);
+	rec->set_frame_allocator(blocks);
+
+	// rx [interface ...], packets of all interfaces are merged into one reciever.
+	DiversityReceiver diversity(rec);
+	const char *default_interface = "wlan0";
+	const char **interfaces = argc > 1 ? (const char**)argv+1 : &default_interface;
+	int interface_count = argc > 1 ? argc-1 : 1;
+	for(int i=0; i<interface_count && i<DIVERSITY_MAX_ADAPTERS; i++)
+	{
+		APCAP_RX *rx = new APCAP_RX(interfaces[i], 0);
+		rx->set_doorbell(diversity.doorbell());
+		diversity.add_adapter(rx);
+	}
 
 	int64_t last_fps_show = getus();
 	int valid = 0;
 	int invalid = 0;
-	int wifi_byte_counter = 0;
 	int frame_byte_counter = 0;
 
 	while(1)
@@ -85,43 +56,36 @@ int main(int argc,char** argv)
 		if (getus() > last_fps_show + 1000000)
 		{
 			last_fps_show = getus();
-			fprintf(stderr, "%d+%d=%dfps, %d/%d Kbyte/s(%.2f%%), %ddbm\n", valid, invalid, valid + invalid, 
-				frame_byte_counter/1024, wifi_byte_counter/1024, 100.0*wifi_byte_counter/frame_byte_counter, rx.get_latest_rssi());
+			fprintf(stderr, "%d+%d=%dfps, %d Kbyte/s\n", valid, invalid, valid + invalid, frame_byte_counter/1024);
+			for(int i=0; i<diversity.adapter_count(); i++)
+			{
+				diversity_stats stats;
+				diversity.get_stats(i, &stats);
+				fprintf(stderr, "  %s: %ddbm, %d packets, %d unique(%.1f%%), %d bad fcs, %d corrected, %d invalid\n", interfaces[i], stats.rssi,
+					stats.packets, stats.unique, stats.packets ? 100.0*stats.unique/stats.packets : 0.0, stats.bad_fcs, stats.corrected, stats.invalid);
+			}
 
 			valid = 0;
 			invalid = 0;
-			wifi_byte_counter = 0;
 			frame_byte_counter = 0;
 		}
 
-		if (rx.available() == 0)
+		if (diversity.poll(10000) == 0)
 		{
-			usleep(10000);
+			rec->check_timeout();
 			continue;
 		}
 
-		// feed reciever with pcap packets
-		uint8_t data[4096];
-		int size = 0;
-		while((size=rx.read(data, 4096)) > 0)
-		{
-			rec->put_packet(data, size);
-			wifi_byte_counter += size;
-		}
-
 		frame * f = frame_cache->get_frame();
 		if (!f)
-		{
-			usleep(10000);
 			continue;
-		}
 
 		frame_byte_counter += f->payload_size;
 
 		if (!f->integrality)
 		{
 			invalid ++;
-			release_frame(f);
+			frame_cache->release(f);
 			continue;
 		}
 
@@ -132,10 +96,13 @@ int main(int argc,char** argv)
 		fflush(stdout);
 
 		if (frame_size>f->payload_size-4)
+		{
+			frame_cache->release(f);
 			continue;
+		}
 
 		valid ++;		
-		release_frame(f);
+		frame_cache->release(f);
 	}
 
 	return 0;
@@ -15,6 +15,7 @@
 #include <algorithm/motion_detector.h>
 #include <Algorithm/battery_estimator.h>
 #include <HAL/sensors/PX4flow.h>
+#include <utils/log_block.h>
 
 using namespace sensors;
 
@@ -256,29 +257,17 @@ int main(int argc, char* argv[])
 	float flow_on[3] = {0};
 	float flow_on_mf[3] = {0};
 
-	while (fread(&time, 1, 8, in) == 8)
-	{
-		uint8_t tag = time >> 56;
-		uint16_t tag_ex = 0xffff;
-		time = time & ~((uint64_t)0xff << 56);
-		char data[65536];
-		int size = 24;
+	// plain and compressed (log_block.h) logs alike.
+	log_reader reader(in);
+	if (reader.compressed())
+		printf("compressed log\n");
 
-		if (tag == TAG_EXTENDED_DATA)		// extended variable length data packets
-		{
-			if (fread(&tag_ex, 1, 2, in) != 2)
-				break;
-			if (fread(&size, 1, 2, in) != 2)
-				break;
-			if (fread(data, 1, size, in) != size)
-				break;
-		}
-		else
-		{
-			size = 24;
-			if (fread(data, 1, 24, in) != 24)
-				break;
-		}
+	uint8_t tag;
+	uint16_t tag_ex;
+	int size;
+	static char data[65536];
+	while (reader.read_record(&time, &tag, &tag_ex, data, &size) == 0)
+	{
 
 		// handle packet data here..
 		if (tag == TAG_PPM_DATA)
@@ -295,6 +284,39 @@ int main(int argc, char* argv[])
 			memcpy(batt_state_on, data, 8);
 		}
 
+		if (tag_ex == TAG_LOG_DROPPED && size >= sizeof(log_drop_header))
+		{
+			log_drop_header *h = (log_drop_header*)data;
+			log_drop_entry *e = (log_drop_entry*)(h+1);
+			printf("%.3fs: dropped records from %.3fs to %.3fs, logger busy:%d/%d/%d\n", time/1000000.0, h->first/1000000.0, h->last/1000000.0, h->busy[0], h->busy[1], h->busy[2]);
+			for(int i=0; i<h->count && (char*)(e+i+1) <= data + size; i++)
+				printf("    tag %02x/%d, priority %d: %d records, %d bytes\n", e[i].tag, e[i].tag_ex, e[i].priority, e[i].records, e[i].bytes);
+		}
+
+		// full rate imu captures go to a csv of their own, sample times are interpolated inside a block.
+		if (tag_ex == TAG_IMU_BURST && size >= sizeof(imu_burst_header))
+		{
+			static FILE *burst = NULL;
+			if (!burst)
+			{
+				char burst_name[300];
+				sprintf(burst_name, "%s.imu.csv", argv[1]);
+				burst = fopen(burst_name, "wb");
+				if (burst)
+					fprintf(burst, "burst,counter,t,ax,ay,az,gx,gy,gz\r\n");
+			}
+
+			imu_burst_header *h = (imu_burst_header*)data;
+			imu_burst_sample *s = (imu_burst_sample*)(h+1);
+			for(int i=0; burst && i<h->count && (char*)(s+i+1) <= data + size; i++)
+			{
+				double t = h->count > 1 ? h->first + (double)(h->last - h->first) * i / (h->count-1) : h->first;
+				fprintf(burst, "%d,%u,%.6f,%f,%f,%f,%f,%f,%f\r\n", h->burst, h->counter+i, t/1000000.0,
+					s[i].accel[0]/IMU_BURST_ACCEL_SCALE, s[i].accel[1]/IMU_BURST_ACCEL_SCALE, s[i].accel[2]/IMU_BURST_ACCEL_SCALE,
+					s[i].gyro[0]/IMU_BURST_GYRO_SCALE, s[i].gyro[1]/IMU_BURST_GYRO_SCALE, s[i].gyro[2]/IMU_BURST_GYRO_SCALE);
+			}
+		}
+
 
 		if (tag_ex == TAG_EXTRA_GPS_DATA)
 		{
@@ -742,6 +764,9 @@ int main(int argc, char* argv[])
 	for(int i=0; i<sat.num_sat_visible; i++)
 		printf("sat:%d, %ddb, residual:%d\n", sats[i].gnss_id, sats[i].cno, sats[i].residual);
 
+	if (reader.damaged_blocks())
+		printf("%d damaged blocks skipped\n", reader.damaged_blocks());
+
 	fclose(in);
 	fclose(out);
 	if(excel)
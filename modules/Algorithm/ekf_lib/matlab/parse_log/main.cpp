@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include<string.h>
 #include "RFData.h"
+#include "../../../../utils/log_block.h"
 #define PI 3.141592654
 int main(int argc, char* argv[])
 {
@@ -44,29 +45,14 @@ int main(int argc, char* argv[])
 	quadcopter_data quad;
 	quadcopter_data2 quad2;
 	ekf_data ekf;
-	while (fread(&time, 1, 8, in) == 8)
+	// plain and compressed logs alike, see utils/log_block.h.
+	log_reader reader(in);
+	uint8_t tag;
+	uint16_t tag_ex;
+	int size;
+	static char data[65536];
+	while (reader.read_record(&time, &tag, &tag_ex, data, &size) == 0)
 	{
-		uint8_t tag = time >> 7*8;//The Highest byte of eight byte is tag
-		uint16_t tag_ex=-1;
-		time = time & ~((uint64_t)0xff << 56);
-		char data[65536];
-		int size = 24;
-
-		if (tag == TAG_EXTENDED_DATA)		// extended variable length data packets
-		{
-			if (fread(&tag_ex, 1, 2, in) != 2)
-				break;
-			if (fread(&size, 1, 2, in) != 2)
-				break;
-			if (fread(data, 1, size, in) != size)
-				break;
-		}
-		else
-		{
-			size = 24;
-			if (fread(data, 1, 24, in) != 24)
-				break;
-		}
 
 		// handle packet data here..
 		if (tag == TAG_PPM_DATA)
@@ -3429,6 +3429,76 @@ FRESULT f_truncate (
 
 
 
+#if _USE_EXPAND
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Blocks to the File (backported from R0.12)      */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_expand (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD fsz,		/* File size to be expanded to */
+	BYTE opt		/* Operation mode 0:Find and prepare or 1:Find and allocate */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, stcl, scl, ncl, tcl;
+
+
+	res = validate(fp);						/* Check validity of the object */
+	if (res == FR_OK && fp->err) res = (FRESULT)fp->err;
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	fs = fp->fs;
+	if (fsz == 0 || fp->fsize != 0 || !(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
+
+	n = (DWORD)fs->csize * SS(fs);			/* Cluster size */
+	tcl = fsz / n + ((fsz % n) ? 1 : 0);	/* Number of clusters required */
+	stcl = fs->last_clust;
+	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+
+	scl = clst = stcl; ncl = 0;
+	for (;;) {								/* Find a contiguous cluster block */
+		n = get_fat(fs, clst);
+		if (n == 1) { res = FR_INT_ERR; break; }
+		if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		if (n == 0) {						/* Is it a free cluster? */
+			if (++ncl == tcl) break;		/* Break if a contiguous cluster block is found */
+		} else {
+			ncl = 0;						/* Not a free cluster */
+		}
+		if (++clst >= fs->n_fatent) {		/* A block cannot wrap around the end of the FAT */
+			clst = 2; ncl = 0;
+		}
+		if (ncl == 0) scl = clst;			/* Next block starts here */
+		if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous cluster? */
+	}
+
+	if (res == FR_OK) {						/* A contiguous free area is found */
+		if (opt) {							/* Allocate it now */
+			for (clst = scl, n = tcl; n && res == FR_OK; clst++, n--)	/* Create a cluster chain on the FAT */
+				res = put_fat(fs, clst, (n == 1) ? 0x0FFFFFFF : clst + 1);
+			if (res == FR_OK) {
+				fs->last_clust = scl + tcl - 1;
+				fp->sclust = scl;			/* Update object allocation information */
+				fp->fsize = fsz;
+				fp->flag |= FA__WRITTEN;
+				if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSINFO */
+					fs->free_clust -= tcl;
+					fs->fsi_flag |= 1;
+				}
+			}
+		} else {							/* Set it as suggested point for next allocation */
+			fs->last_clust = scl - 1;
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Delete a File or Directory                                            */
 /*-----------------------------------------------------------------------*/
@@ -53,6 +53,10 @@
 /* To enable f_forward() function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
 
 
+#define	_USE_EXPAND		1	/* 0:Disable or 1:Enable */
+/* To enable f_expand() function, set _USE_EXPAND to 1 and set _FS_READONLY to 0 */
+
+
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
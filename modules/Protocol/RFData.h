@@ -372,9 +372,50 @@ enum EXTENDED_DATA_TYPES
 	TAG_ATTITUDE_CONTROLLER_DATA = 27,
 	TAG_2NDBARO = 28,
 	TAG_FLOW = 29,
+	TAG_LOG_DROPPED = 30,
+	TAG_IMU_BURST = 31,
 	
 };
 
+// TAG_LOG_DROPPED: records the logger dropped since the last such record, written in front of the first record that fits again.
+// log_drop_header, then log_drop_header.count log_drop_entry.
+typedef struct
+{
+	int64_t first;				// timestamp of the first dropped record
+	int64_t last;				// timestamp of the last dropped record
+	uint32_t busy[3];			// dropped because the logger was in use by another context, per priority class, tags unknown
+	uint16_t count;
+	uint16_t reserved;
+} log_drop_header;
+
+typedef struct
+{
+	uint8_t tag;				// fixed size record tag, TAG_EXTENDED_DATA for extended records
+	uint8_t priority;			// log_priority
+	uint16_t tag_ex;			// extended tag, 0xffff for fixed size records, tag and tag_ex 0 for "other tags"
+	uint32_t records;
+	uint32_t bytes;
+} log_drop_entry;
+
+// TAG_IMU_BURST: raw imu samples of a capture at full imu rate, imu_burst_header then imu_burst_header.count imu_burst_sample.
+// counter counts the samples since the capture started, a jump between two records is the number of samples lost.
+#define IMU_BURST_ACCEL_SCALE 200.0f			// LSB per m/s^2
+#define IMU_BURST_GYRO_SCALE 900.0f				// LSB per rad/s
+typedef struct
+{
+	uint32_t counter;			// counter of the first sample
+	uint16_t count;
+	uint16_t burst;				// capture number since boot
+	int64_t first;				// timestamp of the first sample
+	int64_t last;				// timestamp of the last sample
+} imu_burst_header;
+
+typedef struct
+{
+	int16_t accel[3];			// body frame, calibrated, unfiltered
+	int16_t gyro[3];
+} imu_burst_sample;
+
 typedef struct _posc_ext_data
 {
 	float pos[2];
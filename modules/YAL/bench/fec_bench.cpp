@@ -0,0 +1,355 @@
+// FEC throughput and latency benchmark.
+// codec:      cauchy encode/decode sweep over k, m, block size and loss pattern.
+// end-to-end: FrameSender -> lossy in-memory block device -> reciever.
+//
+// usage: fec_bench [-c|-e] [-k k] [-r parity_ratio] [-b block_bytes] [-l loss] [-n frames] [-s]
+//   -c / -e  codec / end-to-end only
+//   -s       force scalar GF(256) kernels
+// fixed -k/-r/-b/-l values replace the corresponding sweep.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <YAL/fec/cauchy_gf256.h>
+#include <YAL/fec/gf256.h>
+#include <YAL/fec/sender.h>
+#include <YAL/fec/reciever.h>
+#include <Protocol/crc32.h>
+
+static int64_t getns()
+{
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	return (int64_t)tv.tv_sec * 1000000000 + tv.tv_nsec;
+}
+
+static double percentile_us(std::vector<int64_t> &samples, int percent)
+{
+	if (samples.empty())
+		return 0;
+	std::sort(samples.begin(), samples.end());
+	size_t i = samples.size() * percent / 100;
+	if (i >= samples.size())
+		i = samples.size() - 1;
+	return samples[i] / 1000.0;
+}
+
+// random: independent loss with probability loss.
+// bursty: gilbert-elliott, every packet in bad state is lost, mean burst length of BURST_LENGTH packets.
+#define BURST_LENGTH 4.0f
+
+enum loss_type
+{
+	loss_random = 0,
+	loss_bursty = 1,
+};
+
+static const char *loss_name[] = {"random", "bursty"};
+
+class loss_model
+{
+public:
+	loss_model(loss_type type, float loss):type(type), loss(loss), bad(false)
+	{
+		to_good = 1.0f / BURST_LENGTH;
+		to_bad = loss < 1.0f ? loss * to_good / (1.0f - loss) : 1.0f;
+	}
+
+	bool lost()
+	{
+		float r = (float)rand() / RAND_MAX;
+		if (type == loss_random)
+			return r < loss;
+
+		bad = bad ? (r >= to_good) : (r < to_bad);
+		return bad;
+	}
+
+protected:
+	loss_type type;
+	float loss;
+	float to_good;
+	float to_bad;
+	bool bad;
+};
+
+static void bench_codec(int k, int m, int block_bytes, loss_type type, float loss, int frames)
+{
+	std::vector<uint8_t> data(k * block_bytes);
+	std::vector<uint8_t> recovery(m * block_bytes);
+	std::vector<uint8_t> work(m * block_bytes);
+	const unsigned char *data_ptrs[256];
+	for(size_t i=0; i<data.size(); i++)
+		data[i] = rand();
+	for(int i=0; i<k; i++)
+		data_ptrs[i] = &data[i * block_bytes];
+
+	std::vector<int64_t> encode_time;
+	std::vector<int64_t> decode_time;
+	int64_t encode_total = 0;
+	int64_t decode_total = 0;
+	int decoded = 0;
+	int failed = 0;
+	int corrupted = 0;
+	loss_model model(type, loss);
+
+	for(int f=0; f<frames; f++)
+	{
+		int64_t t = getns();
+		cauchy_gf256_encode(k, m, data_ptrs, &recovery[0], block_bytes);
+		t = getns() - t;
+		encode_time.push_back(t);
+		encode_total += t;
+
+		// pick the first k surviving rows, like the reciever does
+		Block blocks[256];
+		int count = 0;
+		bool erased = false;
+		for(int row=0; row<k+m && count<k; row++)
+		{
+			if (model.lost())
+			{
+				erased |= row < k;
+				continue;
+			}
+
+			if (row < k)
+			{
+				blocks[count].data = (unsigned char*)data_ptrs[row];
+			}
+			else
+			{
+				memcpy(&work[(row-k) * block_bytes], &recovery[(row-k) * block_bytes], block_bytes);
+				blocks[count].data = &work[(row-k) * block_bytes];
+			}
+			blocks[count].row = row;
+			count++;
+		}
+
+		if (count < k)
+		{
+			failed++;
+			continue;
+		}
+		if (!erased)
+			continue;
+
+		t = getns();
+		int res = cauchy_gf256_decode(k, m, blocks, k, block_bytes);
+		t = getns() - t;
+		decode_time.push_back(t);
+		decode_total += t;
+		decoded++;
+
+		for(int i=0; i<k; i++)
+			if (res || memcmp(blocks[i].data, data_ptrs[blocks[i].row], block_bytes))
+			{
+				corrupted++;
+				break;
+			}
+	}
+
+	double bytes = (double)k * block_bytes;
+	printf("%4d %4d %5d %-6s %4.0f%% | %8.1f %8.1f %8.1f | %8.1f %8.1f %8.1f | %5d %5d %d\n",
+		k, m, block_bytes, loss_name[type], loss*100,
+		bytes * frames * 1000 / encode_total, percentile_us(encode_time, 50), percentile_us(encode_time, 99),
+		decoded ? bytes * decoded * 1000 / decode_total : 0, percentile_us(decode_time, 50), percentile_us(decode_time, 99),
+		decoded, failed, corrupted);
+}
+
+// in-memory block device, drops packets by a loss model and queues the rest.
+class lossy_device : public HAL::IBlockDevice
+{
+public:
+	lossy_device(loss_type type, float loss):model(type, loss){}
+
+	virtual int write(const void *buf, int block_size)
+	{
+		if (!model.lost())
+			packets.push_back(std::vector<uint8_t>((const uint8_t*)buf, (const uint8_t*)buf + block_size));
+		return block_size;
+	}
+	virtual int read(void *buf, int max_block_size, bool remove = true){return 0;}
+	virtual int available(){return packets.size();}
+
+	std::vector<std::vector<uint8_t> > packets;
+protected:
+	loss_model model;
+};
+
+// frame payload: crc32(4) + size(4) + seq(4) + data
+class latency_sink : public IFrameReciever
+{
+public:
+	latency_sink(std::vector<int64_t> *send_time):send_time(send_time), delivered(0), corrupted(0), bytes(0){}
+
+	virtual int handle_event(){return 0;}
+	virtual int handle_frame(const frame &f)
+	{
+		if (!f.integrality)
+		{
+			corrupted++;
+			return 0;
+		}
+
+		int seq = *(int*)((uint8_t*)f.payload+4);
+		if (seq >= 0 && seq < (int)send_time->size())
+			latency.push_back(getns() - (*send_time)[seq]);
+		delivered++;
+		bytes += *(int*)f.payload;
+		return 0;
+	}
+
+	std::vector<int64_t> *send_time;
+	std::vector<int64_t> latency;
+	int delivered;
+	int corrupted;
+	int64_t bytes;
+};
+
+#define E2E_P_FRAME_SIZE 2000
+#define E2E_IDR_FRAME_SIZE 20000
+#define E2E_GOP 30
+
+static void bench_end_to_end(float ratio, loss_type type, float loss, bool low_latency, int frames)
+{
+	lossy_device device(type, loss);
+	FrameSender sender;
+	sender.set_block_device(&device);
+	sender.config(PACKET_SIZE, ratio);
+
+	std::vector<int64_t> send_time(frames);
+	latency_sink sink(&send_time);
+	reciever rec(&sink);
+	rec.set_low_latency(low_latency);
+
+	std::vector<uint8_t> payload(E2E_IDR_FRAME_SIZE + 8);
+	for(size_t i=0; i<payload.size(); i++)
+		payload[i] = rand();
+
+	std::vector<int64_t> send_cost;
+	int64_t start = getns();
+	for(int seq=0; seq<frames; seq++)
+	{
+		int size = (seq % E2E_GOP) ? E2E_P_FRAME_SIZE : E2E_IDR_FRAME_SIZE;
+		*(int*)&payload[8] = seq;
+		*(int*)&payload[4] = size;
+		*(uint32_t*)&payload[0] = crc32(0, &payload[4], size + 4);
+
+		send_time[seq] = getns();
+		sender.send_frame(&payload[0], size + 8);
+		send_cost.push_back(getns() - send_time[seq]);
+
+		for(size_t i=0; i<device.packets.size(); i++)
+			rec.put_packet(&device.packets[i][0], device.packets[i].size());
+		device.packets.clear();
+	}
+	rec.set_timeout(0);
+	rec.check_timeout();
+	int64_t total = getns() - start;
+
+	printf("%4.2f %-6s %4.0f%% %-4s | %8.1f %8.1f %8.1f | %8.1f %8.1f | %5d %5d %5d\n",
+		ratio, loss_name[type], loss*100, low_latency ? "low" : "full",
+		sink.bytes * 1000.0 / total, percentile_us(send_cost, 50), percentile_us(send_cost, 99),
+		percentile_us(sink.latency, 50), percentile_us(sink.latency, 99),
+		sink.delivered, frames - sink.delivered - sink.corrupted, sink.corrupted);
+}
+
+int main(int argc, char **argv)
+{
+	bool codec = true;
+	bool end_to_end = true;
+	int fixed_k = 0;
+	float fixed_ratio = 0;
+	int fixed_block = 0;
+	float fixed_loss = -1;
+	int frames = 2000;
+
+	cauchy_gf256_init();
+	for(int i=1; i<argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0)
+			end_to_end = false;
+		else if (strcmp(argv[i], "-e") == 0)
+			codec = false;
+		else if (strcmp(argv[i], "-s") == 0)
+			gf256_use_scalar(1);
+		else if (i+1 < argc && strcmp(argv[i], "-k") == 0)
+			fixed_k = atoi(argv[++i]);
+		else if (i+1 < argc && strcmp(argv[i], "-r") == 0)
+			fixed_ratio = atof(argv[++i]);
+		else if (i+1 < argc && strcmp(argv[i], "-b") == 0)
+			fixed_block = atoi(argv[++i]);
+		else if (i+1 < argc && strcmp(argv[i], "-l") == 0)
+			fixed_loss = atof(argv[++i]);
+		else if (i+1 < argc && strcmp(argv[i], "-n") == 0)
+			frames = atoi(argv[++i]);
+		else
+		{
+			printf("usage: %s [-c|-e] [-k k] [-r parity_ratio] [-b block_bytes] [-l loss] [-n frames] [-s]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	printf("gf256 kernels: %s\n", gf256_kernel_name());
+
+	const int ks[] = {4, 8, 16, 32, 64, 127};
+	const float ratios[] = {0.25f, 0.5f, 1.0f};
+	const int blocks[] = {200, 512, 1400};
+	const float losses[] = {0.05f, 0.2f};
+
+	if (codec)
+	{
+		printf("\ncodec, %d frames each, MB/s of data blocks, latency in us\n", frames);
+		printf("   k    m block loss         | enc MB/s  enc p50  enc p99 | dec MB/s  dec p50  dec p99 |  dec  fail corrupted\n");
+		for(int ki=0; ki<6; ki++)
+		for(int ri=0; ri<3; ri++)
+		for(int bi=0; bi<3; bi++)
+		for(int li=0; li<2; li++)
+		for(int type=0; type<2; type++)
+		{
+			int k = fixed_k ? fixed_k : ks[ki];
+			float ratio = fixed_ratio > 0 ? fixed_ratio : ratios[ri];
+			int block_bytes = fixed_block ? fixed_block : blocks[bi];
+			float loss = fixed_loss >= 0 ? fixed_loss : losses[li];
+			int m = (int)(k * ratio + 0.5f);
+			if (m < 1)
+				m = 1;
+			if (m > MAX_NPAR)
+				m = MAX_NPAR;
+			if (k + m > 255)
+				continue;
+
+			// each fixed dimension runs once
+			if ((fixed_k && ki) || (fixed_ratio > 0 && ri) || (fixed_block && bi) || (fixed_loss >= 0 && li))
+				continue;
+
+			bench_codec(k, m, block_bytes, (loss_type)type, loss, frames);
+		}
+	}
+
+	if (end_to_end)
+	{
+		printf("\nend-to-end, %d frames (%d byte P-frames, %d byte IDR every %d), MB/s of frame data, latency in us\n",
+			frames, E2E_P_FRAME_SIZE, E2E_IDR_FRAME_SIZE, E2E_GOP);
+		printf("ratio loss          mode |     MB/s send p50 send p99 |  e2e p50  e2e p99 |    ok  lost corrupted\n");
+		for(int ri=0; ri<3; ri++)
+		for(int li=0; li<2; li++)
+		for(int type=0; type<2; type++)
+		for(int low_latency=0; low_latency<2; low_latency++)
+		{
+			float ratio = fixed_ratio > 0 ? fixed_ratio : ratios[ri];
+			float loss = fixed_loss >= 0 ? fixed_loss : losses[li];
+			if ((fixed_ratio > 0 && ri) || (fixed_loss >= 0 && li))
+				continue;
+
+			bench_end_to_end(ratio, (loss_type)type, loss, low_latency != 0, frames);
+		}
+	}
+
+	return 0;
+}
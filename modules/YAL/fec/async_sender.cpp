@@ -0,0 +1,220 @@
+#include "async_sender.h"
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+AsyncFrameSender::AsyncFrameSender(int queue_length/* = 4*/, async_sender_policy policy/* = policy_drop_oldest*/, int block_timeout/* = 20000*/)
+:policy(policy)
+,block_timeout(block_timeout)
+,dropped(0)
+{
+	// one slot in encoding and one in injection at least, otherwise there is no pipelining.
+	if (queue_length < 2)
+		queue_length = 2;
+	if (queue_length > ASYNC_SENDER_MAX_QUEUE)
+		queue_length = ASYNC_SENDER_MAX_QUEUE;
+	slot_count = queue_length;
+
+	for(int i=0; i<slot_count; i++)
+	{
+		slots[i].payload = new uint8_t[ASYNC_SENDER_MAX_FRAME_SIZE];
+		slots[i].payload_size = 0;
+		slots[i].frame.parity_blocks = new uint8_t[MAX_NPAR*MAX_PAYLOAD_SIZE];
+		free_slots.push(&slots[i]);
+	}
+
+	pthread_mutex_init(&cs, NULL);
+	pthread_cond_init(&slot_freed, NULL);
+	pthread_cond_init(&raw_ready, NULL);
+	pthread_cond_init(&encoded_ready, NULL);
+
+	worker_run = true;
+	inject_run = true;
+	pthread_create(&encode_thread, NULL, encode_entry, this);
+	pthread_create(&inject_thread, NULL, inject_entry, this);
+}
+
+AsyncFrameSender::~AsyncFrameSender()
+{
+	// queue a pending long block, then let the workers drain the queue: encoder first, injector after it.
+	flush_block();
+
+	pthread_mutex_lock(&cs);
+	worker_run = false;
+	pthread_cond_broadcast(&raw_ready);
+	pthread_cond_broadcast(&slot_freed);
+	pthread_mutex_unlock(&cs);
+	pthread_join(encode_thread, NULL);
+
+	pthread_mutex_lock(&cs);
+	inject_run = false;
+	pthread_cond_broadcast(&encoded_ready);
+	pthread_mutex_unlock(&cs);
+	pthread_join(inject_thread, NULL);
+
+	pthread_cond_destroy(&slot_freed);
+	pthread_cond_destroy(&raw_ready);
+	pthread_cond_destroy(&encoded_ready);
+	pthread_mutex_destroy(&cs);
+
+	for(int i=0; i<slot_count; i++)
+	{
+		delete [] slots[i].payload;
+		delete [] slots[i].frame.parity_blocks;
+	}
+}
+
+int AsyncFrameSender::set_policy(async_sender_policy policy, int block_timeout)
+{
+	pthread_mutex_lock(&cs);
+	this->policy = policy;
+	this->block_timeout = block_timeout;
+	pthread_mutex_unlock(&cs);
+
+	return 0;
+}
+
+int AsyncFrameSender::queued_frames()
+{
+	pthread_mutex_lock(&cs);
+	int count = slot_count - free_slots.count();
+	pthread_mutex_unlock(&cs);
+
+	return count;
+}
+
+int AsyncFrameSender::dropped_frames()
+{
+	pthread_mutex_lock(&cs);
+	int count = dropped;
+	pthread_mutex_unlock(&cs);
+
+	return count;
+}
+
+int AsyncFrameSender::get_stats(sender_stats *out)
+{
+	FrameSender::get_stats(out);
+
+	pthread_mutex_lock(&cs);
+	out->frames_dropped = dropped;
+	out->queue_depth += slot_count - free_slots.count();
+	pthread_mutex_unlock(&cs);
+
+	return 0;
+}
+
+int AsyncFrameSender::submit_frame(const void *payload, int payload_size, float protection, int subframe_count)
+{
+	if (payload_size <= 0 || payload_size > ASYNC_SENDER_MAX_FRAME_SIZE)
+		return -1;
+
+	int res = 0;
+	slot *s = NULL;
+	pthread_mutex_lock(&cs);
+
+	if (free_slots.count() == 0 && policy == policy_block)
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		int64_t ns = deadline.tv_nsec + (int64_t)block_timeout * 1000;
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec = ns % 1000000000;
+
+		while (free_slots.count() == 0 && worker_run)
+		{
+			if (pthread_cond_timedwait(&slot_freed, &cs, &deadline) == ETIMEDOUT)
+				break;
+		}
+	}
+
+	if (free_slots.pop(&s) < 0)
+	{
+		// drop the oldest frame which is not touched by workers yet,
+		// or the new one if everything is already in the pipeline.
+		dropped++;
+		res = HAL::error_queue_full;
+		if (policy != policy_drop_oldest || raw_slots.pop(&s) < 0)
+		{
+			pthread_mutex_unlock(&cs);
+			return res;
+		}
+	}
+
+	pthread_mutex_unlock(&cs);
+
+	// slot is owned by us now, copy outside the lock.
+	memcpy(s->payload, payload, payload_size);
+	s->payload_size = payload_size;
+	s->protection = protection;
+	s->subframe_count = subframe_count;
+
+	pthread_mutex_lock(&cs);
+	raw_slots.push(s);
+	pthread_cond_signal(&raw_ready);
+	pthread_mutex_unlock(&cs);
+
+	return res;
+}
+
+void* AsyncFrameSender::encode_worker()
+{
+	while(1)
+	{
+		slot *s = NULL;
+		pthread_mutex_lock(&cs);
+		while (worker_run && raw_slots.count() == 0)
+			pthread_cond_wait(&raw_ready, &cs);
+		if (raw_slots.count() == 0)
+		{
+			pthread_mutex_unlock(&cs);
+			break;
+		}
+		raw_slots.pop(&s);
+		pthread_mutex_unlock(&cs);
+
+		bool ok = encode_frame(s->payload, s->payload_size, &s->frame, s->protection, s->subframe_count) == 0;
+
+		pthread_mutex_lock(&cs);
+		if (ok)
+		{
+			encoded_slots.push(s);
+			pthread_cond_signal(&encoded_ready);
+		}
+		else
+		{
+			free_slots.push(s);
+			pthread_cond_signal(&slot_freed);
+		}
+		pthread_mutex_unlock(&cs);
+	}
+
+	return 0;
+}
+
+void* AsyncFrameSender::inject_worker()
+{
+	while(1)
+	{
+		slot *s = NULL;
+		pthread_mutex_lock(&cs);
+		while (inject_run && encoded_slots.count() == 0)
+			pthread_cond_wait(&encoded_ready, &cs);
+		if (encoded_slots.count() == 0)
+		{
+			pthread_mutex_unlock(&cs);
+			break;
+		}
+		encoded_slots.pop(&s);
+		pthread_mutex_unlock(&cs);
+
+		transmit_frame(&s->frame);
+
+		pthread_mutex_lock(&cs);
+		free_slots.push(s);
+		pthread_cond_signal(&slot_freed);
+		pthread_mutex_unlock(&cs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include "sender.h"
+#include <utils/fifo.h>
+
+// FrameSender with a bounded frame queue and two worker threads:
+// one cauchy-encodes queued frames, the other injects encoded frames,
+// so frame N+1's parity is computed while frame N is on air.
+// send_frame() only copies the frame into a preallocated slot.
+
+#define ASYNC_SENDER_MAX_QUEUE 16
+#define ASYNC_SENDER_MAX_FRAME_SIZE (255*MAX_PAYLOAD_SIZE)
+
+enum async_sender_policy
+{
+	policy_drop_oldest = 0,		// full queue: drop oldest frame not yet encoded, never stall the caller.
+	policy_block = 1,			// full queue: wait up to block_timeout for a free slot, then drop the new frame.
+};
+
+class AsyncFrameSender : public FrameSender
+{
+public:
+	AsyncFrameSender(int queue_length = 4, async_sender_policy policy = policy_drop_oldest, int block_timeout = 20000);
+	virtual ~AsyncFrameSender();
+
+	int set_policy(async_sender_policy policy, int block_timeout);		// block_timeout in us
+	int queued_frames();
+	int dropped_frames();
+	virtual int get_stats(sender_stats *stats);
+
+protected:
+	// queue a frame for encoding and transmission.
+	// returns 0 on success, HAL::error_queue_full if the frame (or an older one) was dropped.
+	virtual int submit_frame(const void *payload, int payload_size, float protection, int subframe_count);
+
+	// the encoder and the injector both update stats, under cs.
+	virtual void lock_stats(){pthread_mutex_lock(&cs);}
+	virtual void unlock_stats(){pthread_mutex_unlock(&cs);}
+
+	typedef struct
+	{
+		uint8_t *payload;
+		int payload_size;
+		float protection;
+		int subframe_count;
+		encoded_frame frame;
+	} slot;
+
+	slot slots[ASYNC_SENDER_MAX_QUEUE];
+	CircularQueue<slot*, ASYNC_SENDER_MAX_QUEUE> free_slots;
+	CircularQueue<slot*, ASYNC_SENDER_MAX_QUEUE> raw_slots;			// waiting for encoding
+	CircularQueue<slot*, ASYNC_SENDER_MAX_QUEUE> encoded_slots;		// waiting for injection
+	int slot_count;
+	async_sender_policy policy;
+	int block_timeout;
+	int dropped;
+
+	bool worker_run;					// encoder: stop once raw_slots is drained
+	bool inject_run;					// injector: stop once encoded_slots is drained
+	pthread_t encode_thread;
+	pthread_t inject_thread;
+	pthread_mutex_t cs;
+	pthread_cond_t slot_freed;
+	pthread_cond_t raw_ready;
+	pthread_cond_t encoded_ready;
+
+	void* encode_worker();
+	void* inject_worker();
+	static void * encode_entry(void *p){return ((AsyncFrameSender*)p)->encode_worker();}
+	static void * inject_entry(void *p){return ((AsyncFrameSender*)p)->inject_worker();}
+};
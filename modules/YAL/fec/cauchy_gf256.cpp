@@ -0,0 +1,135 @@
+#include "cauchy_gf256.h"
+#include "gf256.h"
+#include <string.h>
+
+// cauchy matrix x[r] = k + r, y[c] = c, with each column scaled so that row 0 is all ones:
+// element(r, c) = (x[0] ^ y[c]) / (x[r] ^ y[c])
+// column scaling keeps every square submatrix invertible.
+static inline uint8_t matrix_element(int k, int r, int c)
+{
+	return gf256_div(k ^ c, (k + r) ^ c);
+}
+
+int cauchy_gf256_init()
+{
+	return gf256_init();
+}
+
+int cauchy_gf256_encode(int k, int m, const unsigned char *data_ptrs[], void *recovery_blocks, int block_bytes)
+{
+	if (k <= 0 || m <= 0 || k + m > 256 || block_bytes <= 0)
+		return -1;
+
+	uint8_t *out = (uint8_t*)recovery_blocks;
+	for(int r=0; r<m; r++, out+=block_bytes)
+	{
+		// single data block: every recovery block is a copy of it
+		if (k == 1)
+		{
+			memcpy(out, data_ptrs[0], block_bytes);
+			continue;
+		}
+
+		gf256_mul_mem(out, matrix_element(k, r, 0), data_ptrs[0], block_bytes);
+		for(int c=1; c<k; c++)
+			gf256_muladd_mem(out, matrix_element(k, r, c), data_ptrs[c], block_bytes);
+	}
+
+	return 0;
+}
+
+int cauchy_gf256_decode(int k, int m, Block *blocks, int block_count, int block_bytes)
+{
+	if (k <= 1)
+	{
+		blocks[0].row = 0;
+		return 0;
+	}
+
+	if (k + m > 256 || block_count < k)
+		return -1;
+
+	// sort blocks into original and recovery
+	Block *original[256] = {0};
+	Block *recovery[256];
+	int recovery_count = 0;
+	for(int i=0; i<k; i++)
+	{
+		if (blocks[i].row < k)
+			original[blocks[i].row] = &blocks[i];
+		else
+			recovery[recovery_count++] = &blocks[i];
+	}
+
+	int erasures[256];
+	int erasure_count = 0;
+	for(int c=0; c<k; c++)
+		if (!original[c])
+			erasures[erasure_count++] = c;
+
+	// k + m <= 256 limits erasures to 128
+	if (erasure_count == 0)
+		return 0;
+	if (erasure_count != recovery_count || erasure_count > 128)
+		return -1;
+
+	// eliminate received original data from recovery blocks,
+	// leaving recovery[i] = sum(element(row_i, e) * erased_e)
+	uint8_t matrix[128][128];
+	for(int i=0; i<recovery_count; i++)
+	{
+		int r = recovery[i]->row - k;
+		for(int c=0; c<k; c++)
+			if (original[c])
+				gf256_muladd_mem(recovery[i]->data, matrix_element(k, r, c), original[c]->data, block_bytes);
+
+		for(int j=0; j<erasure_count; j++)
+			matrix[i][j] = matrix_element(k, r, erasures[j]);
+	}
+
+	// gauss-jordan elimination, applying the same row operations to the blocks.
+	int n = erasure_count;
+	for(int col=0; col<n; col++)
+	{
+		int pivot = col;
+		while (pivot < n && matrix[pivot][col] == 0)
+			pivot++;
+		if (pivot == n)
+			return -1;
+
+		if (pivot != col)
+		{
+			uint8_t tmp[128];
+			memcpy(tmp, matrix[pivot], n);
+			memcpy(matrix[pivot], matrix[col], n);
+			memcpy(matrix[col], tmp, n);
+			Block *b = recovery[pivot];
+			recovery[pivot] = recovery[col];
+			recovery[col] = b;
+		}
+
+		uint8_t scale = gf256_inv(matrix[col][col]);
+		if (scale != 1)
+		{
+			for(int j=col; j<n; j++)
+				matrix[col][j] = gf256_mul(matrix[col][j], scale);
+			gf256_mul_mem(recovery[col]->data, scale, recovery[col]->data, block_bytes);
+		}
+
+		for(int i=0; i<n; i++)
+		{
+			uint8_t factor = matrix[i][col];
+			if (i == col || factor == 0)
+				continue;
+
+			for(int j=col; j<n; j++)
+				matrix[i][j] ^= gf256_mul(factor, matrix[col][j]);
+			gf256_muladd_mem(recovery[i]->data, factor, recovery[col]->data, block_bytes);
+		}
+	}
+
+	for(int i=0; i<n; i++)
+		recovery[i]->row = erasures[i];
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "cauchy_256.h"
+
+// byte-wise Cauchy Reed-Solomon codec on the gf256 region kernels.
+// same contract as cauchy_256_encode()/cauchy_256_decode(), but computed with GF(256)
+// multiply-add over whole blocks instead of XOR bitplanes of block_bytes/8,
+// which is faster for our small (MAX_PAYLOAD_SIZE) blocks and vectorizes with PSHUFB/vtbl.
+// the first recovery block is the XOR of all data blocks, so m = 1 output matches cauchy_256.
+// the other recovery blocks differ from cauchy_256, both ends must use the same codec.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int cauchy_gf256_init();
+int cauchy_gf256_encode(int k, int m, const unsigned char *data_ptrs[], void *recovery_blocks, int block_bytes);
+int cauchy_gf256_decode(int k, int m, Block *blocks, int block_count, int block_bytes);
+
+#ifdef __cplusplus
+}
+#endif
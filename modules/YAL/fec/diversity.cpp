@@ -0,0 +1,194 @@
+#include "diversity.h"
+#include "reciever.h"
+#include <string.h>
+
+// frame_id distance with 8bit wraparound, positive if a is newer than b.
+static int frame_distance(int a, int b)
+{
+	return (int8_t)(uint8_t)(a-b);
+}
+
+// packets this many frames older than the newest frame means the sender restarted.
+#define MAX_LATE_FRAMES 32
+
+DiversityReceiver::DiversityReceiver(reciever *rec)
+:rec(rec)
+{
+	header_decoder.init(2);
+	count = 0;
+	held_count = 0;
+	newest_frame_id = -1;
+	memset(stats, 0, sizeof(stats));
+	memset(seen, 0, sizeof(seen));
+}
+
+int DiversityReceiver::add_adapter(HAL::IBlockDevice *adapter)
+{
+	if (count >= DIVERSITY_MAX_ADAPTERS)
+		return -1;
+
+	adapters[count] = adapter;
+	return count++;
+}
+
+int DiversityReceiver::get_stats(int adapter, diversity_stats *stats)
+{
+	if (adapter < 0 || adapter >= count)
+		return -1;
+
+	int rssi = 0;
+	if (adapters[adapter]->ioctl(HAL::ioctl_get_rssi, &rssi, sizeof(rssi)) == 0)
+		this->stats[adapter].rssi = rssi;
+
+	*stats = this->stats[adapter];
+	return 0;
+}
+
+int DiversityReceiver::ready_entry(void *p)
+{
+	DiversityReceiver *d = (DiversityReceiver*)p;
+	for(int i=0; i<d->count; i++)
+		if (d->adapters[i]->available() > 0)
+			return 1;
+	return 0;
+}
+
+int DiversityReceiver::poll(int timeout)
+{
+	if (count == 0 || bell.wait(timeout, ready_entry, this) <= 0)
+		return 0;
+
+	// one round: drain every adapter, suspect copies wait for a clean one until the round ends.
+	int fed = 0;
+	for(int i=0; i<count; i++)
+	{
+		raw_packet packet;
+		int size;
+		while ((size = adapters[i]->read(&packet, sizeof(packet))) > 0)
+		{
+			// adapters that can't tell are taken as a good frame check.
+			int flags = 0;
+			if (adapters[i]->ioctl(HAL::ioctl_get_block_flags, &flags, sizeof(flags)) < 0)
+				flags = 0;
+			fed += feed(i, &packet, size, flags);
+		}
+	}
+
+	return fed + flush_held();
+}
+
+// clear the dedup table of frame ids the newest frame passes over, they are reused 256 frames later.
+// on a sender restart the held copies of the old frames are fed first, returns num packets fed.
+int DiversityReceiver::forget_frames(int frame_id)
+{
+	if (newest_frame_id < 0 || frame_distance(frame_id, newest_frame_id) < -MAX_LATE_FRAMES)
+	{
+		int fed = flush_held();
+		memset(seen, 0, sizeof(seen));
+		newest_frame_id = frame_id;
+		return fed;
+	}
+
+	while (frame_distance(frame_id, newest_frame_id) > 0)
+	{
+		newest_frame_id = (newest_frame_id + 1) & 0xff;
+		memset(seen[newest_frame_id], 0, sizeof(seen[newest_frame_id]));
+	}
+
+	return 0;
+}
+
+int DiversityReceiver::feed(int adapter, raw_packet *packet, int size, int flags)
+{
+	diversity_stats &s = stats[adapter];
+	s.packets++;
+
+	if (size < HEADER_SIZE)
+	{
+		s.invalid++;
+		return 0;
+	}
+
+	// 2: clean header, 1: corrected in place, 0: beyond correction
+	int g = header_decoder.correct_errors_erasures((unsigned char *)packet, HEADER_SIZE, 0, NULL);
+	if (!g)
+	{
+		s.invalid++;
+		return 0;
+	}
+
+	int fed = forget_frames(packet->frame_id);
+	uint8_t &state = seen[packet->frame_id][packet->packet_id];
+	bool fcs_ok = !(flags & HAL::block_flag_bad_fcs);
+	if (!fcs_ok)
+		s.bad_fcs++;
+	if (g != 2)
+		s.corrected++;
+
+	// the frame check covers the payload too, it ranks before the header.
+	int rank = (fcs_ok ? 2 : 0) + (g == 2 ? 1 : 0);
+	bool clean = rank == 3;
+
+	if (state == DIVERSITY_FED)
+	{
+		s.duplicated++;
+		return fed;
+	}
+
+	if (!clean && state > 0)
+	{
+		// keep the better of the held copy and this one.
+		int i = state - 1;
+		if (held_rank[i] >= rank)
+		{
+			s.duplicated++;
+			return fed;
+		}
+
+		stats[held_adapter[i]].duplicated++;
+		memcpy(&held[i], packet, size);
+		held_size[i] = size;
+		held_adapter[i] = adapter;
+		held_rank[i] = rank;
+		return fed;
+	}
+
+	if (!clean && held_count < DIVERSITY_MAX_HELD)
+	{
+		memcpy(&held[held_count], packet, size);
+		held_size[held_count] = size;
+		held_adapter[held_count] = adapter;
+		held_rank[held_count] = rank;
+		held_count++;
+		state = held_count;
+		return fed;
+	}
+
+	// a clean copy replaces a held one, which is skipped by flush_held()
+	state = DIVERSITY_FED;
+	s.unique++;
+	rec->put_packet(packet, size);
+	return fed + 1;
+}
+
+int DiversityReceiver::flush_held()
+{
+	int fed = 0;
+	for(int i=0; i<held_count; i++)
+	{
+		uint8_t &state = seen[held[i].frame_id][held[i].packet_id];
+		if (state != i + 1)
+		{
+			stats[held_adapter[i]].duplicated++;
+			continue;
+		}
+
+		state = DIVERSITY_FED;
+		stats[held_adapter[i]].unique++;
+		rec->put_packet(&held[i], held_size[i]);
+		fed++;
+	}
+	held_count = 0;
+
+	return fed;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <HAL/Interface/IBlockDevice.h>
+#include <utils/doorbell.h>
+#include "frame.h"
+#include "oRS.h"
+
+class reciever;
+
+#define DIVERSITY_MAX_ADAPTERS 8
+#define DIVERSITY_MAX_HELD 64
+#define DIVERSITY_FED 0xff
+
+// per adapter counters since start.
+typedef struct
+{
+	int packets;				// packets read from the adapter
+	int unique;					// packets fed to the reciever from this adapter, its contribution
+	int duplicated;				// copies another adapter delivered already
+	int corrected;				// headers that needed reed solomon correction
+	int bad_fcs;				// copies the radio flagged with a failed frame check
+	int invalid;				// headers beyond correction
+	int rssi;					// latest rssi in dbm, 0 if the adapter doesn't report it
+} diversity_stats;
+
+// merges FEC packets received by several adapters into one reciever.
+// every (frame_id, packet_id) goes to the reciever once, so a FEC block is completed from all adapters together.
+// a copy with a failed frame check (HAL::ioctl_get_block_flags) or a header that needed correction
+// was hit by bit errors, it is held until the end of the poll() round. a clean copy from another adapter
+// replaces it meanwhile, a suspect copy only if it ranks better: a good frame check first, then a clean header.
+class DiversityReceiver
+{
+public:
+	DiversityReceiver(reciever *rec);
+	~DiversityReceiver(){}
+
+	// adapters should ring doorbell() when packets arrive (e.g. APCAP_RX::set_doorbell()),
+	// otherwise poll() only sees them after its timeout.
+	int add_adapter(HAL::IBlockDevice *adapter);
+	Doorbell *doorbell(){return &bell;}
+
+	// wait up to timeout(us) for packets on any adapter, then drain all adapters into the reciever.
+	// returns num packets fed to the reciever, 0 on timeout.
+	int poll(int timeout);
+
+	int adapter_count(){return count;}
+	int get_stats(int adapter, diversity_stats *stats);
+
+protected:
+	int feed(int adapter, raw_packet *packet, int size, int flags);
+	int flush_held();
+	int forget_frames(int frame_id);
+	static int ready_entry(void *p);
+
+	reciever *rec;
+	Doorbell bell;
+	rsDecoder header_decoder;
+	HAL::IBlockDevice *adapters[DIVERSITY_MAX_ADAPTERS];
+	diversity_stats stats[DIVERSITY_MAX_ADAPTERS];
+	int count;
+
+	// 0: not seen, held index + 1 while a suspect copy is held, DIVERSITY_FED once fed to the reciever
+	uint8_t seen[256][256];
+	int newest_frame_id;				// -1: none yet
+
+	raw_packet held[DIVERSITY_MAX_HELD];
+	int held_size[DIVERSITY_MAX_HELD];
+	int held_adapter[DIVERSITY_MAX_HELD];
+	int held_rank[DIVERSITY_MAX_HELD];
+	int held_count;
+};
@@ -31,4 +31,21 @@ frame *clone_frame(const frame *f)
 	memcpy(o->payload, f->payload, f->payload_size);
 
 	return o;
+}
+
+bool frame_range_valid(const frame_rows *rows, int offset, int size)
+{
+	if (!rows || size <= 0)
+		return false;
+
+	int first = (offset - rows->first_row_offset) / rows->row_size;
+	int last = (offset + size - 1 - rows->first_row_offset) / rows->row_size;
+	if (offset < rows->first_row_offset || last >= rows->row_count)
+		return false;
+
+	for(int i=first; i<=last; i++)
+		if (!rows->received[i])
+			return false;
+
+	return true;
 }
\ No newline at end of file
@@ -16,6 +16,17 @@ typedef struct frame_struct
 	void *payload;
 } frame;
 
+// packet header, same layout as the first HEADER_SIZE bytes of raw_packet.
+typedef struct packet_header_struct
+{
+	uint8_t frame_id;
+	uint8_t packet_id;
+	uint8_t payload_packet_count;
+	uint8_t parity_packet_count;
+	uint8_t subframe_count;
+	uint8_t header_rs[2];
+} packet_header;
+
 // packet structure for IO
 typedef struct raw_packet_struct
 {
@@ -23,11 +34,21 @@ typedef struct raw_packet_struct
 	uint8_t packet_id;
 	uint8_t payload_packet_count;		// 0 means invalid packet
 	uint8_t parity_packet_count;
-	uint8_t last_frame_packet_count;
+	uint8_t subframe_count;				// frames packed in this FEC block, each starts on a packet boundary. 0 or 1: single frame.
 	uint8_t header_rs[2];					// 2 byte reed solomon parity data for header.
 	uint8_t data[MAX_PAYLOAD_SIZE];
 } raw_packet;
 
+// which parts of a partially received frame are valid, see IFrameReciever::handle_partial_frame().
+// data row i covers payload bytes first_row_offset + i*row_size up to first_row_offset + (i+1)*row_size.
+typedef struct frame_rows_struct
+{
+	int row_count;
+	int row_size;
+	int first_row_offset;
+	const bool *received;				// per data row
+} frame_rows;
+
 // interface
 class IFrameReciever
 {
@@ -35,9 +56,25 @@ public:
 	virtual ~IFrameReciever(){};
 	virtual int handle_event() = 0;
 	virtual int handle_frame(const frame &frame) = 0;
+
+	// a frame FEC could not recover, missing rows are zero filled. integrality is always false.
+	// only called if the reciever is told to output partial frames, ignored by default.
+	virtual int handle_partial_frame(const frame &frame, const frame_rows &rows){return 0;}
+};
+
+// frame buffer provider, e.g. FramePool. users without one fall back to alloc_frame()/release_frame().
+class IFrameAllocator
+{
+public:
+	virtual ~IFrameAllocator(){};
+
+	// a frame with payload_size bytes of payload, NULL if none is available.
+	virtual frame *alloc(int payload_size, int frame_id = 0, bool integrality = false) = 0;
+	virtual void release(frame *f) = 0;
 };
 
 // helper function
 void release_frame(frame *f);
 frame *alloc_frame(int payload_size, int frame_id = 0, bool integrality = false);
-frame *clone_frame(const frame *f);
\ No newline at end of file
+frame *clone_frame(const frame *f);
+bool frame_range_valid(const frame_rows *rows, int offset, int size);		// payload bytes offset ~ offset+size-1 all received
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "frame_pool.h"
+#include <string.h>
+
+FramePool::FramePool(int count, int max_payload_size)
+{
+	if (count > FRAME_POOL_MAX)
+		count = FRAME_POOL_MAX;
+	if (count < 0)
+		count = 0;
+
+	this->count = count;
+	this->size = (max_payload_size + 15) & ~15;
+	buffer = new uint8_t[(size_t)this->size * count];
+	free_mask = count == 64 ? ~(uint64_t)0 : (((uint64_t)1 << count) - 1);
+	memset(frames, 0, sizeof(frames));
+	memset(refcount, 0, sizeof(refcount));
+}
+
+FramePool::~FramePool()
+{
+	delete [] buffer;
+}
+
+int FramePool::available()
+{
+	return __builtin_popcountll(__atomic_load_n(&free_mask, __ATOMIC_ACQUIRE));
+}
+
+frame *FramePool::alloc(int payload_size, int frame_id/* = 0*/, bool integrality/* = false*/)
+{
+	if (payload_size > size)
+		return NULL;
+
+	uint64_t mask = __atomic_load_n(&free_mask, __ATOMIC_ACQUIRE);
+	int i;
+	do
+	{
+		if (!mask)
+			return NULL;
+		i = __builtin_ctzll(mask);
+	} while (!__atomic_compare_exchange_n(&free_mask, &mask, mask & ~((uint64_t)1 << i), true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	frame *f = &frames[i];
+	f->payload = buffer + (size_t)i * size;
+	f->payload_size = payload_size;
+	f->frame_id = frame_id;
+	f->integrality = integrality;
+	refcount[i] = 1;
+
+	return f;
+}
+
+void FramePool::release(frame *f)
+{
+	if (!f)
+		return;
+
+	if (!owns(f))
+	{
+		release_frame(f);
+		return;
+	}
+
+	int i = f - frames;
+	if (__atomic_sub_fetch(&refcount[i], 1, __ATOMIC_ACQ_REL) == 0)
+		__atomic_or_fetch(&free_mask, (uint64_t)1 << i, __ATOMIC_RELEASE);
+}
+
+frame *FramePool::retain(const frame *f)
+{
+	if (owns(f))
+	{
+		__atomic_add_fetch(&refcount[f - frames], 1, __ATOMIC_ACQ_REL);
+		return (frame*)f;
+	}
+
+	frame *o = alloc(f->payload_size, f->frame_id, f->integrality);
+	if (o)
+		memcpy(o->payload, f->payload, f->payload_size);
+
+	return o;
+}
+
+FrameQueue::~FrameQueue()
+{
+	frame *f;
+	while (queue.pop(&f) == 0)
+		pool->release(f);
+}
+
+int FrameQueue::handle_frame(const frame &f)
+{
+	frame *o = pool->retain(&f);
+	if (!o)
+	{
+		dropped++;
+		return -1;
+	}
+
+	if (queue.push(o) < 0)
+	{
+		pool->release(o);
+		dropped++;
+		return -1;
+	}
+
+	bell.ring();
+	return 0;
+}
+
+frame *FrameQueue::get_frame()
+{
+	frame *f = NULL;
+	queue.pop(&f);
+
+	return f;
+}
+
+int FrameQueue::wait(int timeout)
+{
+	return bell.wait(timeout, ready_entry, this);
+}
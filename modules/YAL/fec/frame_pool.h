@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <utils/spsc_queue.h>
+#include <utils/doorbell.h>
+#include "frame.h"
+
+#define FRAME_POOL_MAX 64
+#define FRAME_QUEUE_SIZE 16
+
+// fixed number of preallocated, reference counted frames, no heap allocation after construction.
+// alloc() and release() are lock free and may be called from any thread.
+class FramePool : public IFrameAllocator
+{
+public:
+	FramePool(int count, int max_payload_size);
+	~FramePool();
+
+	// a frame with one reference, NULL if payload_size is too large or all frames are in use.
+	virtual frame *alloc(int payload_size, int frame_id = 0, bool integrality = false);
+
+	// drop a reference, the frame returns to the pool with the last one.
+	// frames not from this pool are passed to release_frame().
+	virtual void release(frame *f);
+
+	// keep a frame handed to IFrameReciever::handle_frame():
+	// frames of this pool gain a reference, others are copied into a pool frame. NULL if exhausted.
+	frame *retain(const frame *f);
+
+	bool owns(const frame *f){return f >= frames && f < frames + count;}
+	int max_payload_size(){return size;}
+	int available();
+
+protected:
+	frame frames[FRAME_POOL_MAX];
+	int refcount[FRAME_POOL_MAX];
+	uint8_t *buffer;
+	uint64_t free_mask;				// bit i set: frames[i] is free
+	int count;
+	int size;
+};
+
+// hands frames from the reciever thread to one consumer thread.
+// handle_frame() retains the frame in the pool, zero copy if it came from the same pool,
+// and drops it if the consumer falls behind.
+class FrameQueue : public IFrameReciever
+{
+public:
+	FrameQueue(FramePool *pool):pool(pool), dropped(0){}
+	~FrameQueue();
+
+	virtual int handle_event(){return 0;}
+	virtual int handle_frame(const frame &f);
+
+	// consumer: the oldest frame, NULL if empty. give it back with release().
+	frame *get_frame();
+	void release(frame *f){pool->release(f);}
+
+	// consumer: wait up to timeout(us) for a frame, returns num queued frames, 0 on timeout.
+	int wait(int timeout);
+
+	int dropped_frames(){return dropped;}
+
+protected:
+	FramePool *pool;
+	SPSCQueue<frame*, FRAME_QUEUE_SIZE> queue;
+	Doorbell bell;
+	int dropped;
+
+	static int ready_entry(void *p){return ((FrameQueue*)p)->queue.count();}
+};
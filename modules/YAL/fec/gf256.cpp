@@ -0,0 +1,369 @@
+#include "gf256.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GF256_SSSE3 1
+#define GF256_AVX2 1
+#define GF256_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <tmmintrin.h>
+#define GF256_SSSE3 1
+#define GF256_TARGET(x)
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GF256_NEON 1
+#endif
+
+#define GF256_POLYNOMIAL 0x11d
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t mul_table[256][256];				// mul_table[c][x] = c*x
+static uint8_t nibble_table[256][32];			// c*low nibble (16), c*(high nibble<<4) (16)
+static bool initialized = false;
+
+typedef struct
+{
+	const char *name;
+	void (*muladd)(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c);
+	void (*mul)(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c);
+	void (*add)(uint8_t *dst, const uint8_t *src, int bytes);
+} gf256_kernels;
+
+// scalar
+static void muladd_scalar(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	const uint8_t *row = mul_table[c];
+	for(int i=0; i<bytes; i++)
+		dst[i] ^= row[src[i]];
+}
+
+static void mul_scalar(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	const uint8_t *row = mul_table[c];
+	for(int i=0; i<bytes; i++)
+		dst[i] = row[src[i]];
+}
+
+static void add_scalar(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int i = 0;
+	for(; i+8<=bytes; i+=8)
+	{
+		uint64_t a, b;
+		memcpy(&a, dst+i, 8);
+		memcpy(&b, src+i, 8);
+		a ^= b;
+		memcpy(dst+i, &a, 8);
+	}
+	for(; i<bytes; i++)
+		dst[i] ^= src[i];
+}
+
+static const gf256_kernels scalar_kernels = {"scalar", muladd_scalar, mul_scalar, add_scalar};
+
+#ifdef GF256_SSSE3
+GF256_TARGET("ssse3")
+static inline __m128i mul16_ssse3(__m128i s, __m128i tl, __m128i th, __m128i mask)
+{
+	__m128i l = _mm_shuffle_epi8(tl, _mm_and_si128(s, mask));
+	__m128i h = _mm_shuffle_epi8(th, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+	return _mm_xor_si128(l, h);
+}
+
+GF256_TARGET("ssse3")
+static void muladd_ssse3(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	__m128i tl = _mm_loadu_si128((const __m128i*)nibble_table[c]);
+	__m128i th = _mm_loadu_si128((const __m128i*)(nibble_table[c]+16));
+	__m128i mask = _mm_set1_epi8(0x0f);
+	int i = 0;
+	for(; i+16<=bytes; i+=16)
+	{
+		__m128i p = mul16_ssse3(_mm_loadu_si128((const __m128i*)(src+i)), tl, th, mask);
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(d, p));
+	}
+	muladd_scalar(dst+i, src+i, bytes-i, c);
+}
+
+GF256_TARGET("ssse3")
+static void mul_ssse3(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	__m128i tl = _mm_loadu_si128((const __m128i*)nibble_table[c]);
+	__m128i th = _mm_loadu_si128((const __m128i*)(nibble_table[c]+16));
+	__m128i mask = _mm_set1_epi8(0x0f);
+	int i = 0;
+	for(; i+16<=bytes; i+=16)
+		_mm_storeu_si128((__m128i*)(dst+i), mul16_ssse3(_mm_loadu_si128((const __m128i*)(src+i)), tl, th, mask));
+	mul_scalar(dst+i, src+i, bytes-i, c);
+}
+
+GF256_TARGET("ssse3")
+static void add_ssse3(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int i = 0;
+	for(; i+16<=bytes; i+=16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(src+i))));
+	}
+	add_scalar(dst+i, src+i, bytes-i);
+}
+
+static const gf256_kernels ssse3_kernels = {"ssse3", muladd_ssse3, mul_ssse3, add_ssse3};
+#endif
+
+#ifdef GF256_AVX2
+GF256_TARGET("avx2")
+static inline __m256i load_table_avx2(const uint8_t *table)
+{
+	__m128i t = _mm_loadu_si128((const __m128i*)table);
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(t), t, 1);
+}
+
+GF256_TARGET("avx2")
+static inline __m256i mul32_avx2(__m256i s, __m256i tl, __m256i th, __m256i mask)
+{
+	__m256i l = _mm256_shuffle_epi8(tl, _mm256_and_si256(s, mask));
+	__m256i h = _mm256_shuffle_epi8(th, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+	return _mm256_xor_si256(l, h);
+}
+
+// tails are done with VEX encoded 128bit ops, and upper halves cleared before running
+// SSE encoded code, avoiding AVX-SSE transition penalties.
+GF256_TARGET("avx2")
+static void muladd_avx2(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	__m256i tl = load_table_avx2(nibble_table[c]);
+	__m256i th = load_table_avx2(nibble_table[c]+16);
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	int i = 0;
+	for(; i+32<=bytes; i+=32)
+	{
+		__m256i p = mul32_avx2(_mm256_loadu_si256((const __m256i*)(src+i)), tl, th, mask);
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_xor_si256(d, p));
+	}
+	if (i+16<=bytes)
+	{
+		__m128i p = mul16_ssse3(_mm_loadu_si128((const __m128i*)(src+i)), _mm256_castsi256_si128(tl), _mm256_castsi256_si128(th), _mm256_castsi256_si128(mask));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(d, p));
+		i += 16;
+	}
+	_mm256_zeroupper();
+	muladd_scalar(dst+i, src+i, bytes-i, c);
+}
+
+GF256_TARGET("avx2")
+static void mul_avx2(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	__m256i tl = load_table_avx2(nibble_table[c]);
+	__m256i th = load_table_avx2(nibble_table[c]+16);
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	int i = 0;
+	for(; i+32<=bytes; i+=32)
+		_mm256_storeu_si256((__m256i*)(dst+i), mul32_avx2(_mm256_loadu_si256((const __m256i*)(src+i)), tl, th, mask));
+	if (i+16<=bytes)
+	{
+		__m128i p = mul16_ssse3(_mm_loadu_si128((const __m128i*)(src+i)), _mm256_castsi256_si128(tl), _mm256_castsi256_si128(th), _mm256_castsi256_si128(mask));
+		_mm_storeu_si128((__m128i*)(dst+i), p);
+		i += 16;
+	}
+	_mm256_zeroupper();
+	mul_scalar(dst+i, src+i, bytes-i, c);
+}
+
+GF256_TARGET("avx2")
+static void add_avx2(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int i = 0;
+	for(; i+32<=bytes; i+=32)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i*)(src+i))));
+	}
+	_mm256_zeroupper();
+	add_scalar(dst+i, src+i, bytes-i);
+}
+
+static const gf256_kernels avx2_kernels = {"avx2", muladd_avx2, mul_avx2, add_avx2};
+#endif
+
+#ifdef GF256_NEON
+// aarch64 has a 16 entry table lookup, armv7 looks up 8 bytes at a time from a 2x8 table.
+#if defined(__aarch64__)
+typedef uint8x16_t neon_table;
+static inline neon_table load_table_neon(const uint8_t *table){return vld1q_u8(table);}
+static inline uint8x16_t mul16_neon(uint8x16_t s, neon_table tl, neon_table th, uint8x16_t mask)
+{
+	return veorq_u8(vqtbl1q_u8(tl, vandq_u8(s, mask)), vqtbl1q_u8(th, vshrq_n_u8(s, 4)));
+}
+#else
+typedef uint8x8x2_t neon_table;
+static inline neon_table load_table_neon(const uint8_t *table)
+{
+	neon_table t;
+	t.val[0] = vld1_u8(table);
+	t.val[1] = vld1_u8(table+8);
+	return t;
+}
+static inline uint8x16_t mul16_neon(uint8x16_t s, neon_table tl, neon_table th, uint8x16_t mask)
+{
+	uint8x16_t lo = vandq_u8(s, mask);
+	uint8x16_t hi = vshrq_n_u8(s, 4);
+	uint8x8_t l = veor_u8(vtbl2_u8(tl, vget_low_u8(lo)), vtbl2_u8(th, vget_low_u8(hi)));
+	uint8x8_t h = veor_u8(vtbl2_u8(tl, vget_high_u8(lo)), vtbl2_u8(th, vget_high_u8(hi)));
+	return vcombine_u8(l, h);
+}
+#endif
+
+static void muladd_neon(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	neon_table tl = load_table_neon(nibble_table[c]);
+	neon_table th = load_table_neon(nibble_table[c]+16);
+	uint8x16_t mask = vdupq_n_u8(0x0f);
+	int i = 0;
+	for(; i+16<=bytes; i+=16)
+		vst1q_u8(dst+i, veorq_u8(vld1q_u8(dst+i), mul16_neon(vld1q_u8(src+i), tl, th, mask)));
+	muladd_scalar(dst+i, src+i, bytes-i, c);
+}
+
+static void mul_neon(uint8_t *dst, const uint8_t *src, int bytes, uint8_t c)
+{
+	neon_table tl = load_table_neon(nibble_table[c]);
+	neon_table th = load_table_neon(nibble_table[c]+16);
+	uint8x16_t mask = vdupq_n_u8(0x0f);
+	int i = 0;
+	for(; i+16<=bytes; i+=16)
+		vst1q_u8(dst+i, mul16_neon(vld1q_u8(src+i), tl, th, mask));
+	mul_scalar(dst+i, src+i, bytes-i, c);
+}
+
+static void add_neon(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	int i = 0;
+	for(; i+16<=bytes; i+=16)
+		vst1q_u8(dst+i, veorq_u8(vld1q_u8(dst+i), vld1q_u8(src+i)));
+	add_scalar(dst+i, src+i, bytes-i);
+}
+
+static const gf256_kernels neon_kernels = {"neon", muladd_neon, mul_neon, add_neon};
+#endif
+
+static const gf256_kernels *best_kernels = &scalar_kernels;
+static const gf256_kernels *kernels = &scalar_kernels;
+
+static const gf256_kernels *detect_kernels()
+{
+#if defined(GF256_SSSE3) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &avx2_kernels;
+	if (__builtin_cpu_supports("ssse3"))
+		return &ssse3_kernels;
+#elif defined(GF256_SSSE3)
+	int info[4];
+	__cpuid(info, 1);
+	if (info[2] & (1<<9))
+		return &ssse3_kernels;
+#elif defined(GF256_NEON)
+	// NEON builds (-mfpu=neon, aarch64) may use it anywhere already.
+	return &neon_kernels;
+#endif
+	return &scalar_kernels;
+}
+
+int gf256_init()
+{
+	if (initialized)
+		return 0;
+
+	int x = 1;
+	for(int i=0; i<255; i++)
+	{
+		gf_exp[i] = x;
+		gf_exp[i+255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= GF256_POLYNOMIAL;
+	}
+	gf_exp[510] = gf_exp[0];
+	gf_exp[511] = gf_exp[1];
+	gf_log[0] = 0;
+
+	for(int c=0; c<256; c++)
+	{
+		for(int i=0; i<256; i++)
+			mul_table[c][i] = (c && i) ? gf_exp[gf_log[c] + gf_log[i]] : 0;
+		for(int i=0; i<16; i++)
+		{
+			nibble_table[c][i] = mul_table[c][i];
+			nibble_table[c][i+16] = mul_table[c][i<<4];
+		}
+	}
+
+	best_kernels = detect_kernels();
+	kernels = best_kernels;
+	initialized = true;
+
+	return 0;
+}
+
+const char *gf256_kernel_name()
+{
+	return kernels->name;
+}
+
+void gf256_use_scalar(int scalar)
+{
+	kernels = scalar ? &scalar_kernels : best_kernels;
+}
+
+uint8_t gf256_mul(uint8_t a, uint8_t b)
+{
+	return mul_table[a][b];
+}
+
+uint8_t gf256_div(uint8_t a, uint8_t b)
+{
+	if (a == 0)
+		return 0;
+	return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+uint8_t gf256_inv(uint8_t a)
+{
+	return gf_exp[255 - gf_log[a]];
+}
+
+void gf256_muladd_mem(void *dst, uint8_t c, const void *src, int bytes)
+{
+	if (c == 0)
+		return;
+	if (c == 1)
+		kernels->add((uint8_t*)dst, (const uint8_t*)src, bytes);
+	else
+		kernels->muladd((uint8_t*)dst, (const uint8_t*)src, bytes, c);
+}
+
+void gf256_mul_mem(void *dst, uint8_t c, const void *src, int bytes)
+{
+	if (c == 0)
+		memset(dst, 0, bytes);
+	else if (c == 1)
+		memmove(dst, src, bytes);
+	else
+		kernels->mul((uint8_t*)dst, (const uint8_t*)src, bytes, c);
+}
+
+void gf256_add_mem(void *dst, const void *src, int bytes)
+{
+	kernels->add((uint8_t*)dst, (const uint8_t*)src, bytes);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// GF(256) arithmetic (polynomial 0x11d) and bulk region kernels.
+// region kernels use split-nibble table lookups: PSHUFB (SSSE3/AVX2) or vtbl (NEON),
+// picked at gf256_init() by CPU features, with a scalar fallback.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// build tables and select kernels, safe to call more than once.
+int gf256_init();
+
+// name of the selected kernel set: "avx2", "ssse3", "neon" or "scalar".
+const char *gf256_kernel_name();
+
+// force scalar kernels, for testing and benchmarking.
+void gf256_use_scalar(int scalar);
+
+uint8_t gf256_mul(uint8_t a, uint8_t b);
+uint8_t gf256_div(uint8_t a, uint8_t b);		// b must not be 0
+uint8_t gf256_inv(uint8_t a);					// a must not be 0
+
+// dst ^= c * src
+void gf256_muladd_mem(void *dst, uint8_t c, const void *src, int bytes);
+
+// dst = c * src
+void gf256_mul_mem(void *dst, uint8_t c, const void *src, int bytes);
+
+// dst ^= src
+void gf256_add_mem(void *dst, const void *src, int bytes);
+
+#ifdef __cplusplus
+}
+#endif
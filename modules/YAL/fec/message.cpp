@@ -0,0 +1,525 @@
+#include "message.h"
+#include <string.h>
+#include <Protocol/crc32.h>
+
+#ifdef WIN32
+#include <windows.h>
+static int64_t getus()
+{
+	return (int64_t)GetTickCount() * 1000;
+}
+#else
+#include <time.h>
+static int64_t getus()
+{
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec/1000;
+}
+#endif
+
+// a time critical value this much older than the delivered one means the sender restarted,
+// the random start of the counters makes a restart land inside this range rarely.
+#define MAX_STALE_DISTANCE 1024
+
+int MessageLinkVideo::done_entry(void *p)
+{
+	return __atomic_load_n(&((MessageLinkVideo*)p)->batch, __ATOMIC_ACQUIRE) == NULL;
+}
+
+int MessageLinkVideo::write(const void *buf, int block_size)
+{
+	HAL::block_segment segment = {buf, block_size};
+	return writev(&segment, 1);
+}
+
+int MessageLinkVideo::writev(const HAL::block_segment *segments, int segment_count)
+{
+	HAL::block_vector block = {segments, segment_count};
+	int o = write_batch(&block, 1);
+	if (o <= 0)
+		return o;
+
+	int size = 0;
+	for(int i=0; i<segment_count; i++)
+		size += segments[i].size;
+
+	return size;
+}
+
+int MessageLinkVideo::write_batch(const HAL::block_vector *blocks, int block_count)
+{
+	if (!owner->video_out)
+		return HAL::error_unsupported;
+	if (block_count <= 0)
+		return 0;
+
+	batch_count = block_count;
+	batch_sent = 0;
+	__atomic_store_n(&batch, blocks, __ATOMIC_RELEASE);
+	owner->post();
+
+	// the blocks are the caller's, they must not go away before the scheduler is done with them.
+	while (!done_bell.wait(100000, done_entry, this))
+		;
+
+	return batch_sent;
+}
+
+MessageLink::MessageLink(HAL::IBlockDevice *video_out, HAL::IBlockDevice *message_out)
+:video_out(video_out)
+,message_out(message_out)
+,handler(NULL)
+,video(this)
+{
+	memset(time_critical, 0, sizeof(time_critical));
+	memset(control, 0, sizeof(control));
+	memset(rx_time_critical_valid, 0, sizeof(rx_time_critical_valid));
+	memset(&stats, 0, sizeof(stats));
+	dirty_count = 0;
+	next_dirty = 0;
+	control_seq = getus() & 0xffff;		// unlikely to hit the receiver's dedup history after a restart
+	// time critical counters start at random too, or the receiver takes the first values after a restart as stale.
+	uint32_t seed = (uint32_t)getus() * 2654435761u;
+	for(int i=0; i<256; i++)
+		time_critical[i].seq = (seed >> 16) + i * 257;
+	rx_control_count = 0;
+	max_retries = 3;
+	retransmit_interval = 20000;
+	video_rate = 0;
+	video_burst = 0;
+	video_tokens = 0;
+	last_token_time = getus();
+	posted = 0;
+	handled = 0;
+
+	pthread_mutex_init(&cs, NULL);
+	worker_run = true;
+	pthread_create(&worker_thread, NULL, worker_entry, this);
+}
+
+MessageLink::~MessageLink()
+{
+	worker_run = false;
+	post();
+	pthread_join(worker_thread, NULL);
+	pthread_mutex_destroy(&cs);
+}
+
+int MessageLink::set_video_rate(int rate, int burst)
+{
+	if (rate < 0)
+		return -1;
+
+	// at least a few packets, or nothing ever fits the bucket.
+	if (burst < 4096)
+		burst = 4096;
+
+	video_rate = rate;
+	video_burst = burst;
+
+	return 0;
+}
+
+int MessageLink::set_control_retransmit(int max_retries, int interval)
+{
+	if (max_retries < 0 || interval <= 0)
+		return -1;
+
+	pthread_mutex_lock(&cs);
+	this->max_retries = max_retries;
+	this->retransmit_interval = interval;
+	pthread_mutex_unlock(&cs);
+
+	return 0;
+}
+
+void MessageLink::post()
+{
+	__atomic_add_fetch(&posted, 1, __ATOMIC_SEQ_CST);
+	bell.ring();
+}
+
+int MessageLink::ready_entry(void *p)
+{
+	MessageLink *link = (MessageLink*)p;
+	return __atomic_load_n(&link->posted, __ATOMIC_SEQ_CST) != link->handled;
+}
+
+int MessageLink::send_time_critical(int id, const void *data, int size)
+{
+	if (id < 0 || id > 255 || size < 0 || size > MAX_MESSAGE_SIZE)
+		return -1;
+
+	pthread_mutex_lock(&cs);
+	time_critical_slot &slot = time_critical[id];
+	if (slot.dirty)
+		stats.time_critical_replaced++;
+	else
+		dirty_count++;
+	memcpy(slot.data, data, size);
+	slot.size = size;
+	slot.seq++;
+	slot.dirty = true;
+	pthread_mutex_unlock(&cs);
+
+	post();
+	return 0;
+}
+
+int MessageLink::send_control(int id, const void *data, int size)
+{
+	if (id < 0 || id > 255 || size < 0 || size > MAX_MESSAGE_SIZE)
+		return -1;
+
+	pthread_mutex_lock(&cs);
+	control_slot *slot = NULL;
+	for(int i=0; i<MESSAGE_MAX_PENDING && !slot; i++)
+		if (!control[i].used)
+			slot = &control[i];
+
+	if (!slot)
+	{
+		pthread_mutex_unlock(&cs);
+		return HAL::error_queue_full;
+	}
+
+	memcpy(slot->data, data, size);
+	slot->size = size;
+	slot->id = id;
+	slot->seq = control_seq++;
+	slot->used = true;
+	slot->transmissions = 0;
+	slot->next_time = 0;
+	int seq = slot->seq;
+	pthread_mutex_unlock(&cs);
+
+	post();
+	return seq;
+}
+
+int MessageLink::send_message(int type, int id, int seq, const void *data, int size)
+{
+	uint8_t packet[MESSAGE_HEADER_SIZE + MAX_MESSAGE_SIZE];
+	message_header *header = (message_header*)packet;
+	header->type = type;
+	header->id = id;
+	header->seq = seq;
+	memcpy(packet + MESSAGE_HEADER_SIZE, data, size);
+	header->crc = crc32(0, packet + sizeof(header->crc), MESSAGE_HEADER_SIZE + size - sizeof(header->crc));
+
+	return message_out ? message_out->write(packet, MESSAGE_HEADER_SIZE + size) : 0;
+}
+
+// send the most urgent message, returns 1 if one was sent.
+// *next_time is lowered to the earliest pending retransmission.
+int MessageLink::schedule_messages(int64_t now, int64_t *next_time)
+{
+	uint8_t data[MAX_MESSAGE_SIZE];
+	int type, id, seq, size = 0;
+
+	pthread_mutex_lock(&cs);
+
+	uint16_t ack;
+	if (acks.pop(&ack) == 0)
+	{
+		stats.acks_sent++;
+		pthread_mutex_unlock(&cs);
+		send_message(message_ack, 0, ack, NULL, 0);
+		return 1;
+	}
+
+	// time critical values round robin, so a busy id doesn't starve the others.
+	for(int i=0; i<256 && dirty_count > 0; i++)
+	{
+		int j = (next_dirty + i) & 0xff;
+		time_critical_slot &slot = time_critical[j];
+		if (!slot.dirty)
+			continue;
+
+		type = message_time_critical;
+		id = j;
+		seq = slot.seq;
+		size = slot.size;
+		memcpy(data, slot.data, size);
+		slot.dirty = false;
+		dirty_count--;
+		next_dirty = j + 1;
+		stats.time_critical_sent++;
+		pthread_mutex_unlock(&cs);
+
+		send_message(type, id, seq, data, size);
+		return 1;
+	}
+
+	// oldest due control message, one more interval after its last transmission before giving up.
+	control_slot *due = NULL;
+	for(int i=0; i<MESSAGE_MAX_PENDING; i++)
+	{
+		control_slot *slot = &control[i];
+		if (!slot->used)
+			continue;
+
+		if (slot->next_time > now)
+		{
+			if (slot->next_time < *next_time)
+				*next_time = slot->next_time;
+			continue;
+		}
+
+		if (slot->transmissions > max_retries)
+		{
+			slot->used = false;
+			stats.control_failed++;
+			continue;
+		}
+
+		if (!due || (uint16_t)(control_seq - slot->seq) > (uint16_t)(control_seq - due->seq))
+			due = slot;
+	}
+
+	if (!due)
+	{
+		pthread_mutex_unlock(&cs);
+		return 0;
+	}
+
+	if (due->transmissions++)
+		stats.control_retransmits++;
+	else
+		stats.control_sent++;
+	due->next_time = now + retransmit_interval;
+	if (due->next_time < *next_time)
+		*next_time = due->next_time;
+
+	type = message_control;
+	id = due->id;
+	seq = due->seq;
+	size = due->size;
+	memcpy(data, due->data, size);
+	pthread_mutex_unlock(&cs);
+
+	send_message(type, id, seq, data, size);
+	return 1;
+}
+
+static int block_size(const HAL::block_vector &block)
+{
+	int size = 0;
+	for(int i=0; i<block.segment_count; i++)
+		size += block.segments[i].size;
+	return size;
+}
+
+// hand a run of video packets to video_out, one by one if it doesn't batch.
+void MessageLink::write_video(const HAL::block_vector *blocks, int block_count)
+{
+	if (video_out->write_batch(blocks, block_count) != HAL::error_unsupported)
+		return;
+
+	for(int i=0; i<block_count; i++)
+	{
+		if (video_out->writev(blocks[i].segments, blocks[i].segment_count) != HAL::error_unsupported)
+			continue;
+
+		// device can't gather, assemble the packet here.
+		uint8_t packet[PACKET_SIZE];
+		int size = 0;
+		for(int j=0; j<blocks[i].segment_count; j++)
+		{
+			const HAL::block_segment &segment = blocks[i].segments[j];
+			if (size + segment.size > (int)sizeof(packet))
+				break;
+			memcpy(packet + size, segment.data, segment.size);
+			size += segment.size;
+		}
+		video_out->write(packet, size);
+	}
+}
+
+// release the writer of the current batch.
+void MessageLink::finish_video_batch()
+{
+	__atomic_store_n(&video.batch, (const HAL::block_vector*)NULL, __ATOMIC_RELEASE);
+	video.done_bell.ring();
+}
+
+// send the next run of the current video batch as far as the pacing allows, returns 1 if any was sent.
+int MessageLink::schedule_video(int64_t now, int64_t *next_time)
+{
+	const HAL::block_vector *batch = __atomic_load_n(&video.batch, __ATOMIC_ACQUIRE);
+	if (!batch)
+		return 0;
+
+	int sent = video.batch_sent;
+	int left = video.batch_count - sent;
+	int run = left < MESSAGE_VIDEO_RUN ? left : MESSAGE_VIDEO_RUN;
+
+	// token bucket in byte*us, so frequent calls don't lose fractions.
+	if (video_rate > 0)
+	{
+		video_tokens += (now - last_token_time) * video_rate;
+		last_token_time = now;
+		if (video_tokens > (int64_t)video_burst * 1000000)
+			video_tokens = (int64_t)video_burst * 1000000;
+
+		// wait for the whole run rather than sending packet by packet, as much of it as the burst allows.
+		int64_t need = 0;
+		for(int i=0; i<run; i++)
+		{
+			int64_t packet_need = (int64_t)block_size(batch[sent+i]) * 1000000;
+			if (i > 0 && need + packet_need > (int64_t)video_burst * 1000000)
+			{
+				run = i;
+				break;
+			}
+			need += packet_need;
+		}
+
+		if (video_tokens < need)
+		{
+			int64_t t = now + (need - video_tokens) / video_rate + 1;
+			if (t < *next_time)
+				*next_time = t;
+			return 0;
+		}
+		video_tokens -= need;
+	}
+
+	write_video(batch + sent, run);
+	pthread_mutex_lock(&cs);
+	stats.video_packets += run;
+	stats.video_runs++;
+	pthread_mutex_unlock(&cs);
+
+	__atomic_store_n(&video.batch_sent, sent + run, __ATOMIC_RELEASE);
+	if (sent + run == video.batch_count)
+		finish_video_batch();
+
+	return 1;
+}
+
+void* MessageLink::worker()
+{
+	while(worker_run)
+	{
+		// posts after this point wake the next wait.
+		handled = __atomic_load_n(&posted, __ATOMIC_SEQ_CST);
+
+		int64_t now = getus();
+		int64_t next_time = now + 100000;
+		if (schedule_messages(now, &next_time) || schedule_video(now, &next_time))
+			continue;
+
+		bell.wait(next_time - now, ready_entry, this);
+	}
+
+	// don't leave a writer waiting for a batch that will never be sent.
+	if (__atomic_load_n(&video.batch, __ATOMIC_ACQUIRE))
+		finish_video_batch();
+
+	return 0;
+}
+
+// count a received packet, stats are shared with the scheduler thread.
+void MessageLink::count_received(uint32_t *counter)
+{
+	pthread_mutex_lock(&cs);
+	(*counter)++;
+	pthread_mutex_unlock(&cs);
+}
+
+int MessageLink::put_packet(const void *packet, int size)
+{
+	if (size < MESSAGE_HEADER_SIZE || size > MESSAGE_HEADER_SIZE + MAX_MESSAGE_SIZE)
+	{
+		count_received(&stats.received_invalid);
+		return -1;
+	}
+
+	const message_header *header = (const message_header*)packet;
+	if (header->crc != (uint32_t)crc32(0, (const uint8_t*)packet + sizeof(header->crc), size - sizeof(header->crc)))
+	{
+		count_received(&stats.received_invalid);
+		return -2;
+	}
+
+	const uint8_t *payload = (const uint8_t*)packet + MESSAGE_HEADER_SIZE;
+	int payload_size = size - MESSAGE_HEADER_SIZE;
+
+	if (header->type == message_ack)
+	{
+		pthread_mutex_lock(&cs);
+		for(int i=0; i<MESSAGE_MAX_PENDING; i++)
+		{
+			if (control[i].used && control[i].seq == header->seq)
+			{
+				control[i].used = false;
+				stats.control_acked++;
+			}
+		}
+		pthread_mutex_unlock(&cs);
+		return 0;
+	}
+
+	if (header->type == message_time_critical)
+	{
+		int distance = (int16_t)(header->seq - rx_time_critical_seq[header->id]);
+		if (rx_time_critical_valid[header->id] && distance <= 0 && distance > -MAX_STALE_DISTANCE)
+		{
+			count_received(&stats.received_stale);
+			return 0;
+		}
+
+		rx_time_critical_seq[header->id] = header->seq;
+		rx_time_critical_valid[header->id] = true;
+		count_received(&stats.received_time_critical);
+		if (handler)
+			handler->handle_message(message_time_critical, header->id, payload, payload_size);
+		return 0;
+	}
+
+	if (header->type == message_control)
+	{
+		// ack every copy, the ack of an earlier one may have been lost.
+		pthread_mutex_lock(&cs);
+		acks.push(header->seq);
+		pthread_mutex_unlock(&cs);
+		post();
+
+		int history = rx_control_count < MESSAGE_RX_HISTORY ? rx_control_count : MESSAGE_RX_HISTORY;
+		for(int i=0; i<history; i++)
+		{
+			if (rx_control_seq[i] == header->seq)
+			{
+				count_received(&stats.received_duplicated);
+				return 0;
+			}
+		}
+
+		rx_control_seq[rx_control_count++ % MESSAGE_RX_HISTORY] = header->seq;
+		count_received(&stats.received_control);
+		if (handler)
+			handler->handle_message(message_control, header->id, payload, payload_size);
+		return 0;
+	}
+
+	count_received(&stats.received_invalid);
+	return -3;
+}
+
+int MessageLink::get_stats(message_link_stats *out)
+{
+	pthread_mutex_lock(&cs);
+	*out = stats;
+	out->control_pending = 0;
+	for(int i=0; i<MESSAGE_MAX_PENDING; i++)
+		if (control[i].used)
+			out->control_pending++;
+	pthread_mutex_unlock(&cs);
+
+	out->video_queue_depth = __atomic_load_n(&video.batch, __ATOMIC_ACQUIRE) ? video.batch_count - __atomic_load_n(&video.batch_sent, __ATOMIC_ACQUIRE) : 0;
+	stats_fill_header(&out->header, stats_message_link, sizeof(*out), getus());
+
+	return 0;
+}
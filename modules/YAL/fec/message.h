@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <HAL/Interface/IBlockDevice.h>
+#include <utils/doorbell.h>
+#include <utils/fifo.h>
+#include <utils/link_stats.h>
+#include "frame.h"
+
+// small message classes of the YAL Readme, multiplexed with FEC video on one radio link.
+// messages travel on their own block device (another port), video keeps its FEC packets untouched.
+
+#define MESSAGE_HEADER_SIZE 8
+#define MAX_MESSAGE_SIZE MAX_PAYLOAD_SIZE
+#define MESSAGE_MAX_PENDING 16						// control messages waiting for ack
+#define MESSAGE_MAX_ACKS 32
+#define MESSAGE_RX_HISTORY 32						// control sequence numbers remembered for dedup
+#define MESSAGE_VIDEO_RUN 16						// video packets per video_out->write_batch(), messages wait for one run at most
+
+enum message_type
+{
+	message_time_critical = 1,		// latest value wins, never retransmitted. e.g. stick data
+	message_control = 2,			// sequence numbered, retransmitted until acked or out of retries. e.g. arm, takeoff
+	message_ack = 3,
+};
+
+// message ids used in this tree, the rest are free for applications.
+enum message_id
+{
+	message_id_link_report = 1,		// time critical, link_report from the ground station
+	message_id_stick = 2,			// time critical, 4 floats
+	message_id_idr_request = 3,		// control, uint16 picture id of a damaged picture, the encoder should send an IDR
+};
+
+// wire format, followed by up to MAX_MESSAGE_SIZE bytes payload.
+typedef struct
+{
+	uint32_t crc;					// crc32 of everything behind it, header and payload
+	uint8_t type;					// message_type
+	uint8_t id;
+	uint16_t seq;					// control: link wide sequence, time critical: per id counter, ack: acked sequence
+} message_header;
+
+// message link statistics record, counters since start.
+typedef struct
+{
+	stats_header header;
+	uint32_t time_critical_sent;
+	uint32_t time_critical_replaced;	// overwritten by a newer value before transmission
+	uint32_t control_sent;				// first transmissions
+	uint32_t control_retransmits;
+	uint32_t control_acked;
+	uint32_t control_failed;			// out of retries
+	uint32_t acks_sent;
+	uint32_t video_packets;
+	uint32_t video_runs;				// video_out->write_batch() calls
+	uint32_t received_time_critical;
+	uint32_t received_control;
+	uint32_t received_duplicated;
+	uint32_t received_stale;			// time critical value older than the one delivered
+	uint32_t received_invalid;
+	uint32_t control_pending;			// waiting for ack now
+	uint32_t video_queue_depth;			// packets of the current batch not sent yet
+} message_link_stats;
+
+class IMessageHandler
+{
+public:
+	virtual ~IMessageHandler(){};
+	virtual int handle_message(int type, int id, const void *data, int size) = 0;
+};
+
+class MessageLink;
+
+// the video lane of a MessageLink, see MessageLink::video_device().
+// packets are not copied, a write returns after the scheduler thread handed the whole batch to video_out.
+// one writer thread at a time, an AsyncFrameSender keeps the pacing wait off the encoder.
+class MessageLinkVideo : public HAL::IBlockDevice
+{
+public:
+	virtual int write(const void *buf, int block_size);
+	virtual int writev(const HAL::block_segment *segments, int segment_count);
+	virtual int write_batch(const HAL::block_vector *blocks, int block_count);
+	virtual int read(void *buf, int max_block_size, bool remove = true){return HAL::error_unsupported;}
+	virtual int available(){return HAL::error_unsupported;}
+
+protected:
+	friend class MessageLink;
+	MessageLinkVideo(MessageLink *owner):owner(owner),batch(NULL),batch_count(0),batch_sent(0){}
+	~MessageLinkVideo(){}
+
+	MessageLink *owner;
+
+	// the batch being sent, NULL if none. set by the writer, cleared by the scheduler when done.
+	const HAL::block_vector *batch;
+	int batch_count;
+	int batch_sent;				// advanced by the scheduler while batch is set
+	Doorbell done_bell;
+	static int done_entry(void *p);
+};
+
+// one end of the link. a scheduler thread owns both output devices and sends, in order:
+// acks, time critical messages, due control messages, then one run of up to MESSAGE_VIDEO_RUN video packets
+// in one video_out->write_batch(), and checks again. so a message waits for at most one run here,
+// and video can be paced with set_video_rate() to keep the driver queue short,
+// an IDR burst queued in the driver would delay messages anyway.
+class MessageLink
+{
+public:
+	// video_out carries the FEC packets, NULL on receive only ends.
+	// message_out carries messages and acks, a device on its own port.
+	MessageLink(HAL::IBlockDevice *video_out, HAL::IBlockDevice *message_out);
+	~MessageLink();
+
+	// the block device for FrameSender::set_block_device().
+	HAL::IBlockDevice *video_device(){return &video;}
+
+	// bytes per second of video packets into video_out, with up to burst bytes at once. 0: unpaced.
+	int set_video_rate(int rate, int burst);
+
+	// control messages are sent 1+max_retries times at most, interval(us) apart until acked.
+	int set_control_retransmit(int max_retries, int interval);
+
+	// replaces a pending value of the same id. returns 0, negative values for error.
+	int send_time_critical(int id, const void *data, int size);
+
+	// returns the sequence number of the message, HAL::error_queue_full if too many are waiting for ack.
+	int send_control(int id, const void *data, int size);
+
+	// receiving side: feed packets from the message port, handler is called on the caller's thread.
+	void set_handler(IMessageHandler *handler){this->handler = handler;}
+	int put_packet(const void *packet, int size);
+
+	int get_stats(message_link_stats *stats);
+
+protected:
+	friend class MessageLinkVideo;
+
+	typedef struct
+	{
+		uint8_t data[MAX_MESSAGE_SIZE];
+		int size;
+		uint16_t seq;
+		bool dirty;
+	} time_critical_slot;
+
+	typedef struct
+	{
+		uint8_t data[MAX_MESSAGE_SIZE];
+		int size;
+		uint8_t id;
+		uint16_t seq;
+		bool used;
+		int transmissions;
+		int64_t next_time;
+	} control_slot;
+
+	int send_message(int type, int id, int seq, const void *data, int size);
+	int schedule_messages(int64_t now, int64_t *next_time);
+	int schedule_video(int64_t now, int64_t *next_time);
+	void write_video(const HAL::block_vector *blocks, int block_count);
+	void finish_video_batch();
+	void count_received(uint32_t *counter);
+
+	HAL::IBlockDevice *video_out;
+	HAL::IBlockDevice *message_out;
+	IMessageHandler *handler;
+	MessageLinkVideo video;
+
+	// sending side, under cs
+	pthread_mutex_t cs;
+	time_critical_slot time_critical[256];
+	int dirty_count;
+	int next_dirty;
+	control_slot control[MESSAGE_MAX_PENDING];
+	uint16_t control_seq;
+	int max_retries;
+	int retransmit_interval;
+	CircularQueue<uint16_t, MESSAGE_MAX_ACKS> acks;
+
+	// video pacing, scheduler thread only
+	int video_rate;
+	int video_burst;
+	int64_t video_tokens;
+	int64_t last_token_time;
+
+	// receiving side, caller of put_packet() only
+	uint16_t rx_time_critical_seq[256];
+	bool rx_time_critical_valid[256];
+	uint16_t rx_control_seq[MESSAGE_RX_HISTORY];
+	int rx_control_count;
+
+	message_link_stats stats;		// under cs, written by the scheduler, the senders and put_packet()
+
+	// scheduler thread
+	Doorbell bell;
+	int posted;				// bumped by producers
+	int handled;
+	bool worker_run;
+	pthread_t worker_thread;
+	void* worker();
+	static void * worker_entry(void *p){return ((MessageLink*)p)->worker();}
+	static int ready_entry(void *p);
+	void post();
+};
@@ -0,0 +1,356 @@
+#include "nal_packetizer.h"
+#include <stddef.h>
+#include <string.h>
+#include <Protocol/crc32.h>
+
+#define NAL_MAX_UNITS 256
+#define GROUP_BUFFER_SIZE (255*MAX_PAYLOAD_SIZE)
+#define GROUP_OVERHEAD (8+sizeof(nal_group_header))
+
+static int nal_priority(int nal_type)
+{
+	if (nal_type == 5)
+		return 1;
+	if (nal_type >= 1 && nal_type <= 4)
+		return 2;
+	return 0;
+}
+
+NalPacketizer::NalPacketizer(FrameSender *sender)
+:sender(sender)
+,max_group_size(8000)
+,picture_id(0)
+{
+	protection[0] = 3.0f;
+	protection[1] = 1.5f;
+	protection[2] = 1.0f;
+	group_buffer = new uint8_t[GROUP_BUFFER_SIZE];
+}
+
+NalPacketizer::~NalPacketizer()
+{
+	delete [] group_buffer;
+}
+
+int NalPacketizer::set_protection(int priority, float protection)
+{
+	if (priority < 0 || priority >= NAL_PRIORITY_COUNT || protection <= 0)
+		return -1;
+
+	this->protection[priority] = protection;
+
+	return 0;
+}
+
+int NalPacketizer::set_max_group_size(int max_group_size)
+{
+	if (max_group_size <= 0 || max_group_size > (int)(GROUP_BUFFER_SIZE - GROUP_OVERHEAD))
+		return -1;
+
+	this->max_group_size = max_group_size;
+
+	return 0;
+}
+
+// split annex-b stream into NAL units, each unit includes its start code.
+int NalPacketizer::split_nal_units(const uint8_t *h264, int size, nal_unit *nals, int max_nals)
+{
+	int count = 0;
+	for(int i=0; i+3<size && count<max_nals; i++)
+	{
+		if (h264[i] != 0 || h264[i+1] != 0 || h264[i+2] != 1)
+			continue;
+
+		// 4 byte start code
+		int start = (i > 0 && h264[i-1] == 0) ? i-1 : i;
+		if (count > 0)
+			nals[count-1].size = start - nals[count-1].offset;
+
+		nals[count].offset = start;
+		nals[count].priority = nal_priority(h264[i+3] & 0x1f);
+		count++;
+		i += 2;
+	}
+
+	if (count > 0)
+		nals[count-1].size = size - nals[count-1].offset;
+
+	return count;
+}
+
+int NalPacketizer::send_picture(const void *h264, int size)
+{
+	const uint8_t *p = (const uint8_t*)h264;
+	nal_unit nals[NAL_MAX_UNITS];
+	int nal_count = split_nal_units(p, size, nals, NAL_MAX_UNITS);
+	if (nal_count <= 0)
+		return -1;
+
+	// plan groups: NAL units ordered by priority, packed up to max_group_size.
+	// group_first[i] is index into order[] of group i's first NAL unit.
+	int order[NAL_MAX_UNITS];
+	int group_first[NAL_MAX_GROUPS+1];
+	int group_priority[NAL_MAX_GROUPS];
+	int order_count = 0;
+	int group_count = 0;
+	uint16_t required_mask = 0;
+
+	for(int priority=0; priority<NAL_PRIORITY_COUNT; priority++)
+	{
+		int group_size = 0;
+		for(int i=0; i<nal_count; i++)
+		{
+			if (nals[i].priority != priority)
+				continue;
+
+			// start a new group?
+			if (group_size == 0 || group_size + nals[i].size > max_group_size)
+			{
+				if (group_count >= NAL_MAX_GROUPS)
+					return -1;
+
+				group_first[group_count] = order_count;
+				group_priority[group_count] = priority;
+				if (priority < 2)
+					required_mask |= 1 << group_count;
+				group_count++;
+				group_size = 0;
+			}
+
+			order[order_count++] = i;
+			group_size += nals[i].size;
+		}
+	}
+	group_first[group_count] = order_count;
+
+	// assemble and send each group
+	int res = 0;
+	for(int g=0; g<group_count; g++)
+	{
+		nal_group_header *header = (nal_group_header*)(group_buffer+8);
+		header->picture_id = picture_id;
+		header->group_index = g;
+		header->group_count = group_count;
+		header->priority = group_priority[g];
+		header->reserved = 0;
+		header->required_mask = required_mask;
+
+		int data_size = sizeof(nal_group_header);
+		for(int j=group_first[g]; j<group_first[g+1]; j++)
+		{
+			nal_unit &nal = nals[order[j]];
+			if (8 + data_size + nal.size > GROUP_BUFFER_SIZE)
+				return -1;
+
+			memcpy(group_buffer + 8 + data_size, p + nal.offset, nal.size);
+			data_size += nal.size;
+		}
+
+		*(int*)(group_buffer+4) = data_size;
+		*(uint32_t*)group_buffer = crc32(0, group_buffer+4, data_size+4);
+
+		if (sender->send_frame_protected(group_buffer, data_size + 8, protection[group_priority[g]]) < 0)
+			res = -1;
+	}
+
+	picture_id++;
+
+	return res;
+}
+
+NalDepacketizer::NalDepacketizer(IFrameReciever *cb)
+:cb(cb)
+,allocator(NULL)
+,picture_id(-1)
+,last_picture_id(-1)
+,references_lost(false)
+,picture_size(0)
+{
+	picture = alloc_frame(NAL_MAX_PICTURE_SIZE+4);
+}
+
+NalDepacketizer::~NalDepacketizer()
+{
+	if (allocator)
+		allocator->release(picture);
+	else
+		release_frame(picture);
+}
+
+int NalDepacketizer::set_frame_allocator(IFrameAllocator *allocator)
+{
+	flush();
+
+	if (this->allocator)
+		this->allocator->release(picture);
+	else
+		release_frame(picture);
+
+	// with an allocator the picture frame is taken when a picture starts.
+	this->allocator = allocator;
+	picture = allocator ? NULL : alloc_frame(NAL_MAX_PICTURE_SIZE+4);
+
+	return 0;
+}
+
+int NalDepacketizer::handle_event()
+{
+	return cb ? cb->handle_event() : 0;
+}
+
+int NalDepacketizer::handle_frame(const frame &f)
+{
+	// lost groups are detected from group_count of the others.
+	if (!f.integrality)
+		return 0;
+
+	const nal_group_header *header = open_group(f);
+	if (!header)
+		return -1;
+
+	if (received_mask & (1 << header->group_index))
+		return 0;
+
+	// groups arrive in order, so appending keeps the NAL units in decoding order.
+	if (append(header+1, *(int*)f.payload - sizeof(nal_group_header)) < 0)
+		return -1;
+
+	received_mask |= 1 << header->group_index;
+	received_count++;
+
+	if (received_count == group_count)
+		flush();
+
+	return 0;
+}
+
+// keep the NAL units of a partial group which lie completely in received rows.
+int NalDepacketizer::handle_partial_frame(const frame &f, const frame_rows &rows)
+{
+	if (!frame_range_valid(&rows, 0, 4+sizeof(nal_group_header)))
+		return -1;
+
+	const nal_group_header *header = open_group(f);
+	if (!header)
+		return -1;
+
+	if (received_mask & (1 << header->group_index))
+		return 0;
+
+	// a unit ends at the next start code, so one found in received rows only.
+	// a start code inside a missing row makes the unit before it span that row, and it is dropped.
+	const uint8_t *data = (const uint8_t*)(header+1);
+	int offset = 4 + sizeof(nal_group_header);
+	int size = *(int*)f.payload - sizeof(nal_group_header);
+	int start = -1;
+	for(int i=0; i<=size; i++)
+	{
+		bool start_code = i+3 <= size && data[i] == 0 && data[i+1] == 0 && data[i+2] == 1
+						&& frame_range_valid(&rows, offset+i, 3);
+		if (!start_code && i < size)
+			continue;
+
+		if (start >= 0 && frame_range_valid(&rows, offset+start, i-start))
+		{
+			if (append(data+start, i-start) < 0)
+				return -1;
+		}
+
+		start = i;
+		i += 2;
+	}
+
+	received_mask |= 1 << header->group_index;
+	received_count++;
+	damaged = true;
+
+	if (received_count == group_count)
+		flush();
+
+	return 0;
+}
+
+// validate a group frame and start a new picture if it belongs to one, returns its header or NULL.
+const nal_group_header *NalDepacketizer::open_group(const frame &f)
+{
+	int size = *(int*)f.payload;
+	if (size < (int)sizeof(nal_group_header) || size > f.payload_size-4)
+		return NULL;
+
+	const nal_group_header *header = (const nal_group_header*)((uint8_t*)f.payload+4);
+	if (header->group_index >= header->group_count || header->group_count > NAL_MAX_GROUPS)
+		return NULL;
+
+	// late group of a picture delivered already.
+	if (picture_id < 0 && header->picture_id == last_picture_id)
+		return NULL;
+
+	if (header->picture_id != picture_id)
+	{
+		flush();
+
+		// consumer holds all frames, drop this picture.
+		if (!picture)
+			picture = allocator->alloc(NAL_MAX_PICTURE_SIZE+4);
+		if (!picture)
+		{
+			references_lost = true;
+			return NULL;
+		}
+
+		// whole pictures lost in between?
+		damaged = references_lost || (last_picture_id >= 0 && header->picture_id != ((last_picture_id + 1) & 0xffff));
+		references_lost = false;
+		picture_id = header->picture_id;
+		last_picture_id = picture_id;
+		group_count = header->group_count;
+		received_mask = 0;
+		received_count = 0;
+		picture_size = 0;
+	}
+
+	return header;
+}
+
+int NalDepacketizer::append(const void *data, int size)
+{
+	if (size < 0 || picture_size + size > NAL_MAX_PICTURE_SIZE)
+		return -1;
+
+	memcpy((uint8_t*)picture->payload + 4 + picture_size, data, size);
+	picture_size += size;
+
+	return 0;
+}
+
+int NalDepacketizer::flush()
+{
+	if (picture_id < 0)
+		return 0;
+
+	if (picture_size > 0 && cb)
+	{
+		*(int*)picture->payload = picture_size;
+		picture->frame_id = picture_id;
+		picture->integrality = received_count == group_count && !damaged;
+		picture->payload_size = picture_size + 4;
+		cb->handle_frame(*picture);
+		picture->payload_size = NAL_MAX_PICTURE_SIZE + 4;
+
+		// the consumer took its own reference, if it wanted the picture.
+		if (allocator)
+		{
+			allocator->release(picture);
+			picture = NULL;
+		}
+	}
+	else
+	{
+		references_lost = true;
+	}
+
+	picture_id = -1;
+	picture_size = 0;
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include "sender.h"
+#include "frame.h"
+
+// NAL aware packetization with unequal error protection.
+// an h264 access unit is split into FEC groups by priority, each group is one FrameSender frame:
+//   priority 0: parameter sets and other non-slice NALs (SPS/PPS/SEI/AUD)
+//   priority 1: IDR slices
+//   priority 2: non-IDR slices
+// groups of the same priority are packed slice by slice up to max_group_size bytes.
+// group payload: crc32(4) + size(4) + nal_group_header + NAL units in annex-b format.
+
+#define NAL_MAX_GROUPS 16
+#define NAL_PRIORITY_COUNT 3
+#define NAL_MAX_PICTURE_SIZE (1024*1024)
+
+typedef struct nal_group_header_struct
+{
+	uint16_t picture_id;
+	uint8_t group_index;
+	uint8_t group_count;
+	uint8_t priority;
+	uint8_t reserved;
+	uint16_t required_mask;			// groups of priority 0 and 1, picture is undecodable without them
+} nal_group_header;
+
+class NalPacketizer
+{
+public:
+	NalPacketizer(FrameSender *sender);
+	~NalPacketizer();
+
+	// parity ratio multiplier of each priority class.
+	int set_protection(int priority, float protection);
+	int set_max_group_size(int max_group_size);
+
+	// send an annex-b h264 access unit.
+	int send_picture(const void *h264, int size);
+
+protected:
+	typedef struct
+	{
+		int offset;
+		int size;
+		int priority;
+	} nal_unit;
+
+	int split_nal_units(const uint8_t *h264, int size, nal_unit *nals, int max_nals);
+
+	FrameSender *sender;
+	float protection[NAL_PRIORITY_COUNT];
+	int max_group_size;
+	uint16_t picture_id;
+	uint8_t *group_buffer;
+};
+
+// reassembles pictures from NalPacketizer groups coming out of a reciever.
+// a picture is delivered as soon as all its groups arrived or the next picture starts,
+// slices of lost groups are left out, complete NAL units of partial groups (reciever::set_partial_output()) are kept.
+// output frame payload: size(4) + annex-b data.
+// integrality is false if any part of the picture was lost, or a whole picture before it:
+// the decoder should conceal the missing slices, and the references stay broken until the next IDR.
+class NalDepacketizer : public IFrameReciever
+{
+public:
+	NalDepacketizer(IFrameReciever *cb);
+	~NalDepacketizer();
+
+	virtual int handle_event();
+	virtual int handle_frame(const frame &frame);
+	virtual int handle_partial_frame(const frame &frame, const frame_rows &rows);
+
+	// deliver the pending picture now, e.g. on timeout.
+	int flush();
+
+	// assemble each picture in a frame of allocator (e.g. a FramePool) and hand that frame to cb,
+	// so the consumer can keep it without a copy. its frames must hold NAL_MAX_PICTURE_SIZE+4 bytes.
+	int set_frame_allocator(IFrameAllocator *allocator);
+
+protected:
+	const nal_group_header *open_group(const frame &f);
+	int append(const void *data, int size);
+
+	IFrameReciever *cb;
+	IFrameAllocator *allocator;
+	int picture_id;					// -1: no pending picture
+	int last_picture_id;			// -1: none yet
+	int group_count;
+	int received_count;
+	uint16_t received_mask;
+	bool damaged;					// pending picture lost a part
+	bool references_lost;			// a picture was dropped, the next one is damaged
+	frame *picture;
+	int picture_size;
+};
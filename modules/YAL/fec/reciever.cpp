@@ -4,9 +4,35 @@
 #include "oRS.h"
 #include <stdlib.h>
 #include <assert.h>
-#include "cauchy_256.h"
+#include "cauchy_gf256.h"
 #include <Protocol/crc32.h>
 
+#ifdef WIN32
+#include <windows.h>
+static int64_t getus()
+{
+	return (int64_t)GetTickCount() * 1000;
+}
+#else
+#include <time.h>
+static int64_t getus()
+{
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec/1000;
+}
+#endif
+
+// frame_id distance with 8bit wraparound, positive if a is newer than b.
+static int frame_distance(int a, int b)
+{
+	return (int8_t)(uint8_t)(a-b);
+}
+
+// packets this many frames older than the last output frame means the sender restarted.
+// so does an older frame_id after a silence longer than the timeout.
+#define MAX_LATE_FRAMES 16
+
 reciever::reciever()
 {
 	cb = NULL;
@@ -21,95 +47,310 @@ reciever::reciever(IFrameReciever *cb)
 
 reciever::~reciever()
 {
-// 	delete [] packets;
 }
 
 void reciever::init()
 {
-	cauchy_256_init();
-// 	packets = new raw_packet[270];
-	memset(packets, 0, sizeof(raw_packet) * 256);
-	current_frame_id = -1;
-	current_packet_count = 0;
+	cauchy_gf256_init();
+	for(int i=0; i<RECIEVER_WINDOW; i++)
+		free_slot(&slots[i]);
+	last_output_frame_id = -1;
+	newest_frame_id = -1;
+	newest_opened_frame_id = -1;
+	last_slice_size = 0;
+	last_payload_packet_count = 0;
+	last_packet_time = 0;
+	timeout = 100000;
+	low_latency = false;
+	partial_output = false;
+	allocator = NULL;
+	memset(&report, 0, sizeof(report));
+	memset(&stats, 0, sizeof(stats));
 }
 
-int reciever::put_packet(const void *packet, int size)
+void reciever::free_slot(open_frame *f)
+{
+	f->frame_id = -1;
+	f->payload_packet_count = 0;
+	f->parity_packet_count = 0;
+	f->subframe_count = 1;
+	f->released_subframes = 0;
+	f->next_subframe_row = 0;
+	f->packet_count = 0;
+	memset(f->received, 0, sizeof(f->received));
+}
+
+frame *reciever::new_frame(int payload_size, int frame_id)
 {
-	// assume: no out of order packets
+	frame *f = allocator ? allocator->alloc(payload_size, frame_id, true) : alloc_frame(payload_size, frame_id, true);
+	if (!f)
+		stats.frames_no_buffer++;
 
+	return f;
+}
+
+void reciever::delete_frame(frame *f)
+{
+	if (allocator)
+		allocator->release(f);
+	else
+		release_frame(f);
+}
+
+int reciever::put_packet(const void *packet, int size)
+{
 	// reject ill conditioned packets
-	if (size > sizeof(raw_packet))
+	if (size > (int)sizeof(raw_packet) || size < HEADER_SIZE)
+	{
+		stats.packets_invalid++;
 		return -1;
+	}
 
 	// decode header and check for error
 	rsDecoder dec2;
 	dec2.init(2);
 	int g = dec2.correct_errors_erasures((unsigned char *)packet, HEADER_SIZE, 0, NULL);
 	if (!g)
+	{
+		stats.packets_invalid++;
 		return -2;
+	}
 
-	// check for new frame
 	raw_packet *p = (raw_packet*)packet;
-	if (p->frame_id != current_frame_id)
-		assemble_and_out();
+	int slice_size = p->payload_packet_count + p->parity_packet_count;
+	int subframe_count = p->subframe_count > 1 ? p->subframe_count : 1;
+	if (p->payload_packet_count == 0 || p->parity_packet_count == 0 || slice_size > 255 || p->packet_id >= slice_size
+		|| subframe_count > p->payload_packet_count)
+	{
+		stats.packets_invalid++;
+		return -2;
+	}
+
+	report.packets_received++;
+	stats.packets_received++;
+
+	// late packet of an already output frame? or sender restarted?
+	int64_t now = getus();
+	bool silent = now - last_packet_time > timeout;
+	last_packet_time = now;
+	if (last_output_frame_id >= 0)
+	{
+		int distance = frame_distance(p->frame_id, last_output_frame_id);
+		if (distance < -MAX_LATE_FRAMES || (distance <= 0 && silent))
+		{
+			for(int i=0; i<RECIEVER_WINDOW; i++)
+				if (slots[i].frame_id >= 0)
+					output_up_to(&slots[i]);
+			last_output_frame_id = -1;
+			newest_frame_id = -1;
+			newest_opened_frame_id = -1;
+		}
+		else if (distance <= 0)
+		{
+			stats.packets_late++;
+			return -3;
+		}
+	}
+
+	open_frame *f = get_frame(p->frame_id, p->payload_packet_count, p->parity_packet_count, subframe_count);
+	if (!f)
+	{
+		stats.packets_rejected++;
+		return -4;
+	}
 
 	// place packet in buffer
-	if (packets[p->packet_id].payload_packet_count)
-		printf("warning: possible duplicated packet %d\n", p->packet_id);
+	if (f->received[p->packet_id])
+	{
+		stats.packets_duplicated++;
+		return 0;
+	}
 
  	//printf("rx:packet #%d of frame #%d, (%d+%d packets)\n", p->packet_id, p->frame_id, p->payload_packet_count, p->parity_packet_count);
 
-	memcpy(&packets[p->packet_id], packet, size);
-	current_packet_count ++;
-	current_frame_id = p->frame_id;
+	memcpy(&f->packets[p->packet_id], packet, size);
+	if (size < (int)sizeof(raw_packet))
+		memset((uint8_t*)&f->packets[p->packet_id] + size, 0, sizeof(raw_packet) - size);
+	f->received[p->packet_id] = true;
+	f->packet_count ++;
+	if (newest_frame_id < 0 || frame_distance(p->frame_id, newest_frame_id) > 0)
+		newest_frame_id = p->frame_id;
 
-	// last packet?
-	if (p->packet_id == p->payload_packet_count + p->parity_packet_count - 1)
-		assemble_and_out();
+	// all packets arrived? or decodable already in low latency mode?
+	if (f->packet_count == slice_size || (low_latency && f->packet_count >= f->payload_packet_count))
+		output_up_to(f);
+	else if (f->subframe_count > 1 && p->packet_id < f->payload_packet_count)
+		release_subframes(f);
+
+	output_decodable();
+
+	check_timeout();
 
 	return 0;
 }
 
-int reciever::assemble_and_out()
+reciever::open_frame *reciever::get_frame(int frame_id, int payload_packet_count, int parity_packet_count, int subframe_count)
 {
-	if (current_frame_id < 0 || current_packet_count == 0)
-		return 0;
-
-	int payload_packet_count = 0;
-	int parity_packet_count = 0;
-	for(int i=0; i<256; i++)
+	open_frame *free = NULL;
+	for(int i=0; i<RECIEVER_WINDOW; i++)
 	{
-		if (packets[i].payload_packet_count)
+		if (slots[i].frame_id == frame_id)
 		{
-			payload_packet_count = packets[i].payload_packet_count;
-			parity_packet_count = packets[i].parity_packet_count;
-			break;
+			// inconsistent headers, reject the packet
+			if (slots[i].payload_packet_count != payload_packet_count || slots[i].parity_packet_count != parity_packet_count
+				|| slots[i].subframe_count != subframe_count)
+				return NULL;
+			return &slots[i];
 		}
+
+		if (slots[i].frame_id < 0 && !free)
+			free = &slots[i];
+	}
+
+	// no free slot, push out the oldest frame
+	if (!free)
+	{
+		open_frame *oldest = NULL;
+		for(int i=0; i<RECIEVER_WINDOW; i++)
+			if (!oldest || frame_distance(slots[i].frame_id, oldest->frame_id) < 0)
+				oldest = &slots[i];
+
+		// a packet older than every open frame is not worth evicting for.
+		if (frame_distance(frame_id, oldest->frame_id) < 0)
+			return NULL;
+
+		output_up_to(oldest);
+		free = oldest;
 	}
 
-	// we have enough valid packets? packets properly formed?
-	if (current_packet_count < payload_packet_count || payload_packet_count <= 0 || parity_packet_count <= 0)
+	free->frame_id = frame_id;
+	free->payload_packet_count = payload_packet_count;
+	free->parity_packet_count = parity_packet_count;
+	free->subframe_count = subframe_count;
+	free->released_subframes = 0;
+	free->next_subframe_row = 0;
+	free->packet_count = 0;
+	free->open_time = getus();
+
+	// frames lost completely never open a slot, count the ones skipped since the newest opened frame
+	// with the size of that frame. a frame opened behind it was counted as skipped already.
+	int distance = newest_opened_frame_id < 0 ? 1 : frame_distance(frame_id, newest_opened_frame_id);
+	if (distance > 0)
 	{
-		// no, clear up and exit
-		current_frame_id = -1;
-		current_packet_count = 0;
-		for(int i=0; i<256; i++)
+		report.packets_expected += (distance-1) * last_slice_size + payload_packet_count + parity_packet_count;
+		report.blocks_needed += (distance-1) * last_payload_packet_count + payload_packet_count;
+		newest_opened_frame_id = frame_id;
+		last_slice_size = payload_packet_count + parity_packet_count;
+		last_payload_packet_count = payload_packet_count;
+	}
+
+	return free;
+}
+
+int reciever::get_report(link_report *out)
+{
+	*out = report;
+	out->magic = LINK_REPORT_MAGIC;
+	memset(&report, 0, sizeof(report));
+
+	return 0;
+}
+
+int reciever::get_stats(reciever_stats *out)
+{
+	stats.open_frames = 0;
+	for(int i=0; i<RECIEVER_WINDOW; i++)
+		if (slots[i].frame_id >= 0)
+			stats.open_frames++;
+
+	stats_fill_header(&stats.header, stats_reciever, sizeof(stats), getus());
+	*out = stats;
+
+	return 0;
+}
+
+// output frames which are decodable and have a newer frame behind them,
+// their parity tail is not waited for once the sender moved on. older open frames go out with them.
+int reciever::output_decodable()
+{
+	open_frame *last = NULL;
+	for(int i=0; i<RECIEVER_WINDOW; i++)
+	{
+		open_frame *f = &slots[i];
+		if (f->frame_id < 0 || f->packet_count < f->payload_packet_count || frame_distance(newest_frame_id, f->frame_id) <= 0)
+			continue;
+		if (!last || frame_distance(f->frame_id, last->frame_id) > 0)
+			last = f;
+	}
+
+	if (last)
+		output_up_to(last);
+
+	return 0;
+}
+
+int reciever::check_timeout()
+{
+	int64_t now = getus();
+	for(int i=0; i<RECIEVER_WINDOW; i++)
+		if (slots[i].frame_id >= 0 && now - slots[i].open_time > timeout)
+			output_up_to(&slots[i]);
+
+	return 0;
+}
+
+// output open frames in frame_id order, up to and including last.
+int reciever::output_up_to(open_frame *last)
+{
+	int last_id = last->frame_id;
+	while(1)
+	{
+		open_frame *oldest = NULL;
+		for(int i=0; i<RECIEVER_WINDOW; i++)
 		{
-			memset(&packets[i], 0, sizeof(raw_packet));
-			packets[i].payload_packet_count = 0;
+			if (slots[i].frame_id < 0 || frame_distance(slots[i].frame_id, last_id) > 0)
+				continue;
+			if (!oldest || frame_distance(slots[i].frame_id, oldest->frame_id) < 0)
+				oldest = &slots[i];
 		}
 
-		return -1;
+		if (!oldest)
+			break;
+
+		report.frames++;
+		stats.frames++;
+		latency_histogram_add(&stats.assembly_latency, getus() - oldest->open_time);
+		if (assemble_and_out(oldest) < 0)
+		{
+			report.frames_lost++;
+			stats.frames_lost++;
+		}
+		last_output_frame_id = oldest->frame_id;
+		free_slot(oldest);
 	}
-	
 
-	if (payload_packet_count == 0 || parity_packet_count == 0 || payload_packet_count + parity_packet_count > 255)
+	return 0;
+}
+
+int reciever::assemble_and_out(open_frame *of)
+{
+	int payload_packet_count = of->payload_packet_count;
+	int parity_packet_count = of->parity_packet_count;
+
+	// we have enough valid packets?
+	if (of->packet_count < payload_packet_count)
+	{
+		if (partial_output)
+			output_partial(of);
 		return -1;
+	}
 
 	// assemble and do FEC
 	int slice_size = payload_packet_count + parity_packet_count;
 	int max_packet_payload_size = sizeof(raw_packet)-HEADER_SIZE;
-	frame * f = alloc_frame(payload_packet_count * max_packet_payload_size, current_frame_id, true);
+	frame * f = new_frame(payload_packet_count * max_packet_payload_size, of->frame_id);
+	if (!f)
+		return -1;
 	bool error = false;
 
 #if !USE_CAUCHY
@@ -117,7 +358,7 @@ int reciever::assemble_and_out()
 	int erasures[256];
 	int erasures_count = 0;
 	for(int i=0; i<slice_size; i++)
-		if (packets[i].payload_packet_count == 0)	// current only missing packets checked, TODO: CRC
+		if (!of->received[i])	// current only missing packets checked, TODO: CRC
 			erasures[erasures_count++] = i;
 
 	rsDecoder decoder;
@@ -126,7 +367,7 @@ int reciever::assemble_and_out()
 	for(int i=0; i<max_packet_payload_size; i++)
 	{
 		for(int j=0; j<slice_size; j++)
-			slice_data[j] = packets[j].data[i];		
+			slice_data[j] = of->packets[j].data[i];		
 
 		if (!decoder.correct_errors_erasures(slice_data, slice_size, erasures_count, erasures))
 			error = true;
@@ -138,38 +379,76 @@ int reciever::assemble_and_out()
 		}
 	}
 #else
-	Block blocks[256] = {0};
-	int j = 0;
-	for(int i=0; i<slice_size; i++)
+	// all data packets present, no decoding needed.
+	int data_count = 0;
+	for(int i=0; i<payload_packet_count; i++)
+		if (of->received[i])
+			data_count++;
+
+	int recovered = payload_packet_count - data_count;
+	int bucket = 0;
+	while ((1 << bucket) <= recovered && bucket < RECOVERY_BUCKETS-1)
+		bucket++;
+	stats.recovered_per_frame[bucket]++;
+	if (recovered)
+	{
+		stats.frames_recovered++;
+		stats.blocks_recovered += recovered;
+	}
+
+	if (data_count == payload_packet_count)
+	{
+		for(int i=0; i<payload_packet_count; i++)
+			memcpy((uint8_t*)f->payload+i*max_packet_payload_size, of->packets[i].data, max_packet_payload_size);
+	}
+	else
 	{
-		if (packets[i].payload_packet_count)
+		Block blocks[256] = {0};
+		int j = 0;
+		for(int i=0; i<slice_size; i++)
 		{
-			blocks[j].data = packets[i].data;
-			blocks[j].row = i;
-			j++;
+			if (of->received[i])
+			{
+				blocks[j].data = of->packets[i].data;
+				blocks[j].row = i;
+				j++;
+			}
 		}
-	}
 
-	assert(j>=payload_packet_count);
+		assert(j>=payload_packet_count);
 
-	error = cauchy_256_decode(payload_packet_count, parity_packet_count, blocks, payload_packet_count, max_packet_payload_size);
+		error = cauchy_gf256_decode(payload_packet_count, parity_packet_count, blocks, payload_packet_count, max_packet_payload_size);
 
-// 	for(int i=0; i<payload_packet_count; i++)
-// 		assert(blocks[i].row == i);
+		int copied = 0;
 
-	int copied = 0;
+		for(int i=0; i<j; i++)
+		{
+			if (blocks[i].row < payload_packet_count && blocks[i].data)
+			{
+				memcpy((uint8_t*)f->payload+blocks[i].row*max_packet_payload_size, blocks[i].data, max_packet_payload_size);
+				copied ++;
+			}
+		}
+		assert (copied == payload_packet_count);
+	}
+#endif
 
-	for(int i=0; i<j; i++)
+	// long block: output the sub-frames not released yet, each starts on a data row.
+	if (of->subframe_count > 1)
 	{
-		if (blocks[i].row < payload_packet_count && blocks[i].data)
+		int row = of->next_subframe_row;
+		for(int i=of->released_subframes; i<of->subframe_count && row<payload_packet_count; i++)
 		{
-			memcpy((uint8_t*)f->payload+blocks[i].row*max_packet_payload_size, blocks[i].data, max_packet_payload_size);
-			copied ++;
+			uint8_t *data = (uint8_t*)f->payload + row*max_packet_payload_size;
+			int rows = output_subframe(data, (payload_packet_count - row) * max_packet_payload_size, of->frame_id, !error);
+			if (rows < 0)
+				break;
+			row += rows;
 		}
-	}
 
-	assert (copied == payload_packet_count);
-#endif
+		delete_frame(f);
+		return 0;
+	}
 
 	f->integrality = !error;
 	int frame_data_size = *(int*)((uint8_t*)f->payload+4);
@@ -179,18 +458,116 @@ int reciever::assemble_and_out()
 	else
 		f->integrality = false;
 
+	if (!f->integrality)
+		stats.frames_corrupted++;
+
 	if (cb)
 		cb->handle_frame(*f);
-	release_frame(f);
+	delete_frame(f);
 
-	// clear up
-	current_frame_id = -1;
-	current_packet_count = 0;
-	for(int i=0; i<256; i++)
+	return 0;
+}
+
+// output sub-frames of a long block whose data rows all arrived, without waiting for the whole block.
+// only the oldest open frame may release, to keep output in order.
+int reciever::release_subframes(open_frame *of)
+{
+	for(int i=0; i<RECIEVER_WINDOW; i++)
+		if (slots[i].frame_id >= 0 && frame_distance(slots[i].frame_id, of->frame_id) < 0)
+			return 0;
+
+	int max_packet_payload_size = sizeof(raw_packet)-HEADER_SIZE;
+	while (of->released_subframes < of->subframe_count && of->next_subframe_row < of->payload_packet_count)
+	{
+		int row = of->next_subframe_row;
+		if (!of->received[row])
+			break;
+
+		int frame_data_size = *(int*)(of->packets[row].data+4);
+		if (frame_data_size < 0 || frame_data_size + 8 > (of->payload_packet_count - row) * max_packet_payload_size)
+			break;
+
+		int rows = (frame_data_size + 8 + max_packet_payload_size - 1) / max_packet_payload_size;
+		for(int i=row; i<row+rows; i++)
+			if (!of->received[i])
+				return 0;
+
+		frame *f = new_frame(rows * max_packet_payload_size, of->frame_id);
+		if (!f)
+			break;
+		for(int i=0; i<rows; i++)
+			memcpy((uint8_t*)f->payload + i*max_packet_payload_size, of->packets[row+i].data, max_packet_payload_size);
+		output_subframe((uint8_t*)f->payload, f->payload_size, of->frame_id, true);
+		delete_frame(f);
+
+		of->next_subframe_row += rows;
+		of->released_subframes++;
+	}
+
+	return 0;
+}
+
+// output the data rows of a block FEC can not recover, missing rows zero filled.
+// the first row holds the frame size, the crc can not be checked.
+int reciever::output_partial(open_frame *of)
+{
+	if (of->subframe_count > 1 || !of->received[0] || !cb)
+		return -1;
+
+	int max_packet_payload_size = sizeof(raw_packet)-HEADER_SIZE;
+	int payload_packet_count = of->payload_packet_count;
+	int frame_data_size = *(int*)(of->packets[0].data+4);
+	if (frame_data_size < 0 || frame_data_size + 8 > payload_packet_count * max_packet_payload_size)
+		return -1;
+
+	frame *f = new_frame(payload_packet_count * max_packet_payload_size, of->frame_id);
+	if (!f)
+		return -1;
+
+	for(int i=0; i<payload_packet_count; i++)
 	{
-		packets[i].payload_packet_count = 0;
-		memset(&packets[i], 0, sizeof(raw_packet));
+		uint8_t *row = (uint8_t*)f->payload + i*max_packet_payload_size;
+		if (of->received[i])
+			memcpy(row, of->packets[i].data, max_packet_payload_size);
+		else
+			memset(row, 0, max_packet_payload_size);
 	}
 
+	// same layout as a complete frame: size(4) + data, so row 0 starts 4 bytes before the payload.
+	memmove(f->payload, (uint8_t*)f->payload+4, frame_data_size+4);
+	f->integrality = false;
+
+	frame_rows rows;
+	rows.row_count = payload_packet_count;
+	rows.row_size = max_packet_payload_size;
+	rows.first_row_offset = -4;
+	rows.received = of->received;
+
+	stats.frames_partial++;
+	cb->handle_partial_frame(*f, rows);
+	delete_frame(f);
+
 	return 0;
-}
\ No newline at end of file
+}
+
+// output one sub-frame: crc32(4) + size(4) + data at data, returns data rows it occupies or -1 if corrupted.
+int reciever::output_subframe(uint8_t *data, int max_size, int frame_id, bool integrality)
+{
+	int max_packet_payload_size = sizeof(raw_packet)-HEADER_SIZE;
+	int frame_data_size = *(int*)(data+4);
+	if (frame_data_size < 0 || frame_data_size + 8 > max_size)
+		return -1;
+
+	frame f;
+	f.frame_id = frame_id;
+	f.payload = data+4;
+	f.payload_size = frame_data_size+4;
+	f.integrality = integrality && *(uint32_t*)data == crc32(0, data+4, frame_data_size+4);
+	if (!f.integrality)
+		stats.frames_corrupted++;
+
+	if (cb)
+		cb->handle_frame(f);
+
+	return (frame_data_size + 8 + max_packet_payload_size - 1) / max_packet_payload_size;
+}
@@ -1,20 +1,105 @@
 #include "frame.h"
+#include "redundancy.h"
+#include <utils/link_stats.h>
+
+// max number of frames being reassembled at the same time.
+#define RECIEVER_WINDOW 4
+#define RECOVERY_BUCKETS 9
+
+// reciever statistics record, counters since start.
+typedef struct
+{
+	stats_header header;
+	uint32_t packets_received;			// valid packets
+	uint32_t packets_invalid;			// bad size or header beyond correction
+	uint32_t packets_duplicated;
+	uint32_t packets_late;				// of frames output already
+	uint32_t packets_rejected;			// inconsistent header or no slot
+	uint32_t frames;					// FEC blocks output or dropped
+	uint32_t frames_lost;				// less than payload_packet_count packets
+	uint32_t frames_corrupted;			// decoded, but crc mismatch
+	uint32_t frames_recovered;			// needed recovery blocks
+	uint32_t blocks_recovered;			// data blocks rebuilt from recovery blocks
+	uint32_t recovered_per_frame[RECOVERY_BUCKETS];	// frames by data blocks recovered: 0, 1, 2~3, 4~7 ... 128+
+	uint32_t open_frames;				// frames being reassembled now
+	latency_histogram assembly_latency;	// first packet to output of each block
+	uint32_t frames_no_buffer;			// dropped, frame allocator exhausted
+	uint32_t frames_partial;			// lost, but the data rows which arrived were output
+} reciever_stats;
 
 class reciever
 {
-public:	
+public:
 	reciever();
 	reciever(IFrameReciever *cb);
 	~reciever();
 	int put_packet(const void *packet, int size);
 
+	// output or drop frames which have been open longer than the timeout, put_packet() does this too.
+	// call it periodically if packets may stop arriving.
+	int check_timeout();
+	int set_timeout(int timeout_us){this->timeout = timeout_us; return 0;}
+
+	// frames are output once all their packets arrived, or once they are decodable (any payload_packet_count packets)
+	// and a packet of a newer frame arrived, so a few reordered packets are still waited for.
+	// low latency mode: output a frame as soon as it is decodable, without waiting for a newer frame.
+	// remaining packets of that frame are ignored.
+	int set_low_latency(bool low_latency){this->low_latency = low_latency; return 0;}
+
+	// output blocks FEC can not recover to IFrameReciever::handle_partial_frame(), with the data rows which arrived,
+	// so slices in them can still be decoded. only single frame blocks whose first data row arrived.
+	// rows are passed as received, with a radio passing bad FCS frames a row may be corrupted.
+	int set_partial_output(bool partial_output){this->partial_output = partial_output; return 0;}
+
+	// decode FEC blocks into frames of allocator (e.g. a FramePool) instead of the heap, NULL to restore.
+	// its frames must hold 255*MAX_PAYLOAD_SIZE bytes.
+	int set_frame_allocator(IFrameAllocator *allocator){this->allocator = allocator; return 0;}
+
+	// fill a link report with statistics since last call, rssi is left for the caller.
+	int get_report(link_report *report);
+
+	// statistics since start.
+	int get_stats(reciever_stats *stats);
+
 protected:
+	typedef struct
+	{
+		int frame_id;					// -1: free slot
+		int payload_packet_count;
+		int parity_packet_count;
+		int subframe_count;				// frames packed in this block
+		int released_subframes;			// sub-frames already output before the block completed
+		int next_subframe_row;			// first data row of the next sub-frame to output
+		int packet_count;
+		int64_t open_time;
+		bool received[256];
+		raw_packet packets[256];
+	} open_frame;
+
 	void init();
-	int assemble_and_out();
+	open_frame *get_frame(int frame_id, int payload_packet_count, int parity_packet_count, int subframe_count);
+	int output_up_to(open_frame *last);
+	int output_decodable();
+	int assemble_and_out(open_frame *f);
+	int release_subframes(open_frame *f);
+	int output_partial(open_frame *f);
+	int output_subframe(uint8_t *data, int max_size, int frame_id, bool integrality);
+	void free_slot(open_frame *f);
+	frame *new_frame(int payload_size, int frame_id);
+	void delete_frame(frame *f);
 
-	raw_packet packets[256];
-	int current_frame_id;
-	int current_packet_count;
+	open_frame slots[RECIEVER_WINDOW];
+	int last_output_frame_id;
+	int newest_frame_id;				// newest frame_id a packet arrived for
+	int newest_opened_frame_id;			// for loss accounting of frames which never arrived
+	int last_slice_size;
+	int last_payload_packet_count;
+	int64_t last_packet_time;
+	int64_t timeout;
+	bool low_latency;
+	bool partial_output;
+	link_report report;
+	reciever_stats stats;
 	IFrameReciever *cb;
+	IFrameAllocator *allocator;
 };
-
@@ -0,0 +1,92 @@
+#include "redundancy.h"
+#include <string.h>
+
+// frames after the last report before falling back to fallback_ratio, ~2 seconds at 30fps.
+#define REPORT_TIMEOUT_FRAMES 60
+
+static float fclamp(float v, float low, float high)
+{
+	return v < low ? low : (v > high ? high : v);
+}
+
+RedundancyController::RedundancyController()
+{
+	config(0.25f, 2.0f, 1.5f);
+	config_rssi(-75, 0.05f);
+	loss = 0;
+	ratio = fallback_ratio;
+	report_count = 0;
+	seen_report_count = 0;
+	frames_since_report = REPORT_TIMEOUT_FRAMES;
+}
+
+int RedundancyController::config(float min_ratio, float max_ratio, float fallback_ratio)
+{
+	if (min_ratio <= 0 || max_ratio < min_ratio)
+		return -1;
+
+	this->min_ratio = min_ratio;
+	this->max_ratio = max_ratio;
+	this->fallback_ratio = fallback_ratio;
+
+	return 0;
+}
+
+int RedundancyController::config_rssi(int weak_rssi, float rssi_ratio_per_db)
+{
+	this->weak_rssi = weak_rssi;
+	this->rssi_ratio_per_db = rssi_ratio_per_db;
+
+	return 0;
+}
+
+int RedundancyController::feed_report(const link_report *report)
+{
+	if (report->magic != LINK_REPORT_MAGIC)
+		return -1;
+
+	float l = loss;
+	if (report->packets_expected > 0)
+	{
+		float new_loss = 1.0f - (float)report->packets_received / report->packets_expected;
+		new_loss = fclamp(new_loss, 0, 0.95f);
+
+		// a lost frame means the estimation was too optimistic, push it up.
+		if (report->frames_lost)
+			new_loss += 0.05f;
+
+		if (new_loss > l)
+			l = new_loss;
+		else
+			l = l * 0.9f + new_loss * 0.1f;
+		loss = l;
+	}
+
+	// m/k needed to survive the estimated loss, with 50% margin for loss variance.
+	float lc = fclamp(l, 0, 0.9f);
+	float r = lc / (1-lc) * 1.5f + min_ratio;
+
+	if (report->rssi < weak_rssi)
+		r += (weak_rssi - report->rssi) * rssi_ratio_per_db;
+
+	ratio = fclamp(r, min_ratio, max_ratio);
+	report_count++;
+
+	return 0;
+}
+
+float RedundancyController::parity_ratio()
+{
+	uint32_t count = report_count;
+	if (count != seen_report_count)
+	{
+		seen_report_count = count;
+		frames_since_report = 0;
+	}
+
+	if (frames_since_report >= REPORT_TIMEOUT_FRAMES)
+		return fallback_ratio;
+
+	frames_since_report++;
+	return ratio;
+}
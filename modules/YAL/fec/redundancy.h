@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#define LINK_REPORT_MAGIC 0x524c		// "LR"
+
+// link statistics sent back from the reciever to the sender.
+// counters are accumulated since the previous report.
+typedef struct link_report_struct
+{
+	uint16_t magic;
+	uint16_t frames;					// frames output or dropped by the reciever
+	uint16_t frames_lost;				// frames with less than payload_packet_count packets
+	uint16_t packets_expected;			// sum of payload+parity packet count of all frames
+	uint16_t packets_received;
+	uint16_t blocks_needed;				// sum of payload packet count of all frames
+	int8_t rssi;						// dbm
+	uint8_t reserved;
+} link_report;
+
+// picks the parity ratio of each frame from link reports.
+// loss estimation is fast attack / slow release, frames without a recent report get the fallback ratio.
+// feed_report() and parity_ratio() may run on different threads: the report side publishes the ratio
+// and a report counter, the frame side keeps its own report timeout, each field has one writer.
+class RedundancyController
+{
+public:
+	RedundancyController();
+	~RedundancyController(){}
+
+	// ratio bounds and the ratio used while no reports arrive.
+	// key frames get their extra protection from the caller, e.g. NalPacketizer's per priority protection.
+	int config(float min_ratio, float max_ratio, float fallback_ratio);
+
+	// rssi below weak_rssi(dbm) adds rssi_ratio_per_db for each db.
+	int config_rssi(int weak_rssi, float rssi_ratio_per_db);
+
+	int feed_report(const link_report *report);
+	float parity_ratio();
+
+	float get_loss(){return loss;}
+
+protected:
+	float min_ratio;
+	float max_ratio;
+	float fallback_ratio;
+	int weak_rssi;
+	float rssi_ratio_per_db;
+
+	// report side
+	volatile float loss;
+	volatile float ratio;				// for the latest report
+	volatile uint32_t report_count;
+
+	// frame side
+	uint32_t seen_report_count;
+	int frames_since_report;
+};
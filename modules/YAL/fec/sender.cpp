@@ -3,26 +3,53 @@
 #include <math.h>
 #include <string.h>
 #include "frame.h"
-#include "cauchy_256.h"
+#include "cauchy_gf256.h"
 
-static int imax(int a, int b)
+#ifdef WIN32
+#include <windows.h>
+static int64_t getus()
 {
-	return a>b?a:b;
+	return (int64_t)GetTickCount() * 1000;
 }
+#else
+#include <time.h>
+static int64_t getus()
+{
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_nsec/1000;
+}
+#endif
 
 FrameSender::FrameSender()
 {
-	cauchy_256_init();
+	cauchy_gf256_init();
 	frame_id = 0;
 	block_sender = NULL;
+	redundancy = NULL;
+#if !USE_CAUCHY
 	packets = new raw_packet[256];
+#else
+	packets = NULL;
+#endif
+	current = new encoded_frame;
+	current->parity_blocks = new uint8_t[MAX_NPAR*MAX_PAYLOAD_SIZE];
+	header_rs_encoder.init(sizeof(((packet_header*)0)->header_rs));
 	config(PACKET_SIZE, 1.5);
+
+	block_buffer = NULL;
+	block_size = 0;
+	block_frames = 0;
+	set_long_block(0, 0);
+	memset(&stats, 0, sizeof(stats));
 }
 
 FrameSender::~FrameSender()
 {
 	delete [] packets;
-
+	delete [] current->parity_blocks;
+	delete current;
+	delete [] block_buffer;
 }
 
 int FrameSender::set_block_device(HAL::IBlockDevice *block_sender)
@@ -34,30 +61,113 @@ int FrameSender::set_block_device(HAL::IBlockDevice *block_sender)
 
 int FrameSender::config(int packet_size, float parity_ratio)
 {
+	if (packet_size <= HEADER_SIZE || packet_size > (int)sizeof(raw_packet))
+		return -1;
+
 	this->packet_payload_size = packet_size-HEADER_SIZE;
 	this->parity_ratio = parity_ratio;
 
 	return 0;
 }
 
+int FrameSender::set_redundancy_controller(RedundancyController *controller)
+{
+	redundancy = controller;
+
+	return 0;
+}
+
+int FrameSender::set_long_block(int max_frames, int max_delay, int small_frame_packets/* = 8*/, int max_block_packets/* = 32*/)
+{
+	if (max_block_packets > 255 - MAX_NPAR)
+		return -1;
+
+	flush_block();
+
+	long_block_frames = max_frames;
+	long_block_delay = max_delay;
+	this->small_frame_packets = small_frame_packets;
+	this->max_block_packets = max_block_packets;
+
+	if (long_block_frames > 1 && !block_buffer)
+		block_buffer = new uint8_t[255*MAX_PAYLOAD_SIZE];
+
+	return 0;
+}
+
 int FrameSender::send_frame(const void *payload, int payload_size)
 {
+	return send_frame_protected(payload, payload_size, 1.0f);
+}
+
+int FrameSender::send_frame_protected(const void *payload, int payload_size, float protection)
+{
+	int packet_count = (payload_size + packet_payload_size - 1) / packet_payload_size;
+	if (long_block_frames <= 1 || packet_count > small_frame_packets || packet_count > max_block_packets)
+	{
+		flush_block();
+		return submit_frame(payload, payload_size, protection, 1);
+	}
+
+	if (block_size / packet_payload_size + packet_count > max_block_packets)
+		flush_block();
+
+	// pack the frame on packet boundary, zero padded.
+	if (block_frames == 0)
+	{
+		block_start_time = getus();
+		block_protection = protection;
+	}
+	memcpy(block_buffer + block_size, payload, payload_size);
+	memset(block_buffer + block_size + payload_size, 0, packet_count * packet_payload_size - payload_size);
+	block_size += packet_count * packet_payload_size;
+	block_frames++;
+	if (protection > block_protection)
+		block_protection = protection;
+
+	if (block_frames >= long_block_frames)
+		return flush_block();
+
+	return poll();
+}
+
+int FrameSender::poll()
+{
+	if (block_frames > 0 && getus() - block_start_time >= long_block_delay)
+		return flush_block();
+
+	return 0;
+}
+
+int FrameSender::flush_block()
+{
+	if (block_frames == 0)
+		return 0;
+
+	int res = submit_frame(block_buffer, block_size, block_protection, block_frames);
+	block_frames = 0;
+	block_size = 0;
+
+	return res;
+}
+
+int FrameSender::submit_frame(const void *payload, int payload_size, float protection, int subframe_count)
+{
+#if !USE_CAUCHY
 	int payload_packet_count = (payload_size + packet_payload_size - 1) / packet_payload_size;
-	int parity_packet_count = ceil(payload_packet_count * parity_ratio);
+	int parity_packet_count = ceil(payload_packet_count * parity_ratio * protection);
 	if (parity_packet_count > MAX_NPAR)
 		parity_packet_count = MAX_NPAR;
 	int slice_size = payload_packet_count + parity_packet_count;
 
 	if (slice_size > 255)		// too large frame
 	{
-		printf("too large frame\n");
+		lock_stats();
+		stats.frames_too_large++;
+		unlock_stats();
 		return -1;
 	}
 
-	printf("sending %d bytes frame, %d+%d packets\n", payload_size, payload_packet_count, parity_packet_count);
-
-
-#if !USE_CAUCHY
 	memset(packets, 0, (slice_size) * sizeof(raw_packet));
 	rsEncoder encoder;
 	encoder.init(parity_packet_count);
@@ -82,45 +192,129 @@ int FrameSender::send_frame(const void *payload, int payload_size)
 		for(int j=0; j<slice_size; j++)
 			packets[j].data[i] = slice_data[j];
 	}
+
+	current->frame_id = frame_id++;
+	current->payload_packet_count = payload_packet_count;
+	current->parity_packet_count = parity_packet_count;
+	current->subframe_count = subframe_count;
+	current->block_size = packet_payload_size;
+	for(int i=0; i<slice_size; i++)
+	{
+		packet_header header;
+		build_header(&header, current, i);
+		send_packet(&header, packets[i].data, packet_payload_size);
+	}
+
+	return 0;
 #else
-	uint8_t tmp [256*MAX_PAYLOAD_SIZE];
-	uint8_t *recovery_blocks = tmp + packet_payload_size * payload_packet_count;
-	const unsigned char *data_ptrs[256];
-	memset(packets, 0, (slice_size) * sizeof(raw_packet));
-	for(int i=0; i<payload_packet_count; i++)
+	if (encode_frame(payload, payload_size, current, protection, subframe_count) < 0)
+		return -1;
+
+	return transmit_frame(current);
+#endif
+}
+
+int FrameSender::encode_frame(const void *payload, int payload_size, encoded_frame *out, float protection/* = 1.0f*/, int subframe_count/* = 1*/)
+{
+#if !USE_CAUCHY
+	return -1;
+#else
+	int payload_packet_count = (payload_size + packet_payload_size - 1) / packet_payload_size;
+	float ratio = redundancy ? redundancy->parity_ratio() : parity_ratio;
+	int parity_packet_count = ceil(payload_packet_count * ratio * protection);
+	if (parity_packet_count < 1)
+		parity_packet_count = 1;
+	if (parity_packet_count > MAX_NPAR)
+		parity_packet_count = MAX_NPAR;
+	int slice_size = payload_packet_count + parity_packet_count;
+
+	if (slice_size > 255 || payload_packet_count <= 0)		// too large frame
+	{
+		lock_stats();
+		stats.frames_too_large++;
+		unlock_stats();
+		return -1;
+	}
+
+	int64_t start = getus();
+
+	out->frame_id = frame_id++;
+	out->payload_packet_count = payload_packet_count;
+	out->parity_packet_count = parity_packet_count;
+	out->subframe_count = subframe_count;
+	out->block_size = packet_payload_size;
+
+	// data blocks are encoded and sent straight from the caller's buffer,
+	// only the last partial block is copied for zero padding.
+	int full_packet_count = payload_size / packet_payload_size;
+	for(int i=0; i<full_packet_count; i++)
+		out->data_ptrs[i] = (const uint8_t*)payload + i*packet_payload_size;
+	if (full_packet_count < payload_packet_count)
 	{
-		memcpy(tmp + i*packet_payload_size, (uint8_t*)payload + i*packet_payload_size, imax(payload_size-i*packet_payload_size, packet_payload_size));
-		data_ptrs[i] = tmp + i*packet_payload_size;
+		int tail_size = payload_size - full_packet_count*packet_payload_size;
+		memcpy(out->tail_block, (const uint8_t*)payload + full_packet_count*packet_payload_size, tail_size);
+		memset(out->tail_block + tail_size, 0, packet_payload_size - tail_size);
+		out->data_ptrs[full_packet_count] = out->tail_block;
 	}
 
-	cauchy_256_encode(payload_packet_count, parity_packet_count, data_ptrs, recovery_blocks, packet_payload_size);
+	cauchy_gf256_encode(payload_packet_count, parity_packet_count, out->data_ptrs, out->parity_blocks, packet_payload_size);
+	int64_t latency = getus() - start;
+
+	lock_stats();
+	latency_histogram_add(&stats.encode_latency, latency);
+	unlock_stats();
 
-	for(int i=0; i<payload_packet_count; i++)
-		memcpy(packets[i].data, tmp + i*packet_payload_size, packet_payload_size);
-	for(int i=0; i<parity_packet_count; i++)
-		memcpy(packets[i+payload_packet_count].data, tmp + (i+payload_packet_count)*packet_payload_size, packet_payload_size);
-// 	delete [] tmp;
+	return 0;
 #endif
+}
 
-	// create header rs parity and send out
-	rsEncoder header_rs_encoder;
-	header_rs_encoder.init(sizeof(packets->header_rs));
+int FrameSender::transmit_frame(const encoded_frame *frame)
+{
+	int64_t start = getus();
+	int slice_size = frame->payload_packet_count + frame->parity_packet_count;
+
+	packet_header headers[255];
+	HAL::block_segment segments[255][2];
+	HAL::block_vector blocks[255];
 	for(int i=0; i<slice_size; i++)
 	{
-		packets[i].frame_id = frame_id;
-		packets[i].last_frame_packet_count = 0;
-		packets[i].packet_id = i;
-		packets[i].parity_packet_count = parity_packet_count;
-		packets[i].payload_packet_count = payload_packet_count;
-
-		header_rs_encoder.resetData();
-		header_rs_encoder.append_data((unsigned char*)&packets[i], HEADER_SIZE-sizeof(packets[i].header_rs));
-		header_rs_encoder.output(&packets[i].header_rs[0]);
+		build_header(&headers[i], frame, i);
+		segments[i][0].data = &headers[i];
+		segments[i][0].size = HEADER_SIZE;
+		segments[i][1].data = i < frame->payload_packet_count ? frame->data_ptrs[i] : frame->parity_blocks + (i-frame->payload_packet_count)*frame->block_size;
+		segments[i][1].size = frame->block_size;
+		blocks[i].segments = segments[i];
+		blocks[i].segment_count = 2;
+	}
 
-		send_packet(&packets[i], sizeof(raw_packet));
+	// hand the whole block to the device in one call if it batches submissions.
+	if (!block_sender || block_sender->write_batch(blocks, slice_size) == HAL::error_unsupported)
+	{
+		for(int i=0; i<slice_size; i++)
+			send_packet(&headers[i], segments[i][1].data, frame->block_size);
 	}
+	int64_t latency = getus() - start;
+
+	lock_stats();
+	stats.frames++;
+	stats.subframes += frame->subframe_count;
+	stats.packets_sent += slice_size;
+	stats.parity_packets_sent += frame->parity_packet_count;
+	stats.bytes_sent += (uint64_t)slice_size * (HEADER_SIZE + frame->block_size);
+	latency_histogram_add(&stats.transmit_latency, latency);
+	unlock_stats();
+
+	return 0;
+}
 
-	frame_id++;
+int FrameSender::get_stats(sender_stats *out)
+{
+	lock_stats();
+	*out = stats;
+	unlock_stats();
+
+	out->queue_depth = block_frames;
+	stats_fill_header(&out->header, stats_sender, sizeof(*out), getus());
 
 	return 0;
 }
@@ -131,4 +325,35 @@ int FrameSender::send_packet(const void *payload, int payload_size)
 		block_sender->write(payload, payload_size);
 
 	return 0;
+}
+
+int FrameSender::send_packet(const packet_header *header, const void *data, int data_size)
+{
+	if (!block_sender)
+		return 0;
+
+	HAL::block_segment segments[2] = {{header, HEADER_SIZE}, {data, data_size}};
+	if (block_sender->writev(segments, 2) != HAL::error_unsupported)
+		return 0;
+
+	// device can't gather, assemble the packet here.
+	raw_packet packet;
+	memcpy(&packet, header, HEADER_SIZE);
+	memcpy(packet.data, data, data_size);
+	block_sender->write(&packet, HEADER_SIZE + data_size);
+
+	return 0;
+}
+
+void FrameSender::build_header(packet_header *header, const encoded_frame *frame, int packet_id)
+{
+	header->frame_id = frame->frame_id;
+	header->subframe_count = frame->subframe_count;
+	header->packet_id = packet_id;
+	header->parity_packet_count = frame->parity_packet_count;
+	header->payload_packet_count = frame->payload_packet_count;
+
+	header_rs_encoder.resetData();
+	header_rs_encoder.append_data((unsigned char*)header, HEADER_SIZE-sizeof(header->header_rs));
+	header_rs_encoder.output(&header->header_rs[0]);
 }
\ No newline at end of file
@@ -3,7 +3,40 @@
 #include <stdint.h>
 #include "oRS.h"
 #include "frame.h"
+#include "redundancy.h"
 #include <HAL/Interface/IBlockDevice.h>
+#include <utils/link_stats.h>
+
+// a frame split into data + parity blocks, ready for transmission.
+// data blocks point into the source buffer, which must stay valid until transmitted.
+typedef struct encoded_frame_struct
+{
+	uint8_t frame_id;
+	int payload_packet_count;
+	int parity_packet_count;
+	int subframe_count;
+	int block_size;
+	const uint8_t *data_ptrs[256];
+	uint8_t *parity_blocks;						// MAX_NPAR recovery blocks, stored end-to-end
+	uint8_t tail_block[MAX_PAYLOAD_SIZE];		// zero padded copy of the last, partial data block
+} encoded_frame;
+
+// sender statistics record, counters since start.
+typedef struct
+{
+	stats_header header;
+	uint32_t frames;					// FEC blocks sent
+	uint32_t subframes;					// frames packed in them
+	uint32_t packets_sent;
+	uint32_t parity_packets_sent;
+	uint32_t frames_too_large;
+	uint32_t frames_dropped;			// by a full queue
+	uint32_t queue_depth;				// frames waiting for encoding or injection now
+	uint32_t reserved;
+	uint64_t bytes_sent;				// payload bytes, including FEC headers and parity
+	latency_histogram encode_latency;	// time spent in encode_frame()
+	latency_histogram transmit_latency;	// time spent in transmit_frame()
+} sender_stats;
 
 class FrameSender
 {
@@ -13,14 +46,66 @@ public:
 
 	virtual int set_block_device(HAL::IBlockDevice *block_sender);
 	virtual int config(int packet_size, float residual_ratio);
+
+	// let the controller choose parity ratio of each frame, NULL to use the configured ratio.
+	int set_redundancy_controller(RedundancyController *controller);
+
 	virtual int send_frame(const void *payload, int payload_size);
 	virtual int send_packet(const void *payload, int payload_size);
+
+	// send_frame() with parity ratio scaled by protection, for unequal error protection.
+	virtual int send_frame_protected(const void *payload, int payload_size, float protection);
+
+	// long block mode: frames of no more than small_frame_packets packets are packed into one FEC block,
+	// until max_frames frames or max_delay(us) after the first one. max_frames <= 1 disables it.
+	int set_long_block(int max_frames, int max_delay, int small_frame_packets = 8, int max_block_packets = 32);
+
+	// send out a pending long block if its delay budget is used up, call it regularly.
+	int poll();
+
+	// send one packet as header + data segments, without assembling it first.
+	virtual int send_packet(const packet_header *header, const void *data, int data_size);
+
+	// the two halves of send_frame(), for callers pipelining encoding and transmission.
+	// encode_frame() assigns the next frame_id, out->parity_blocks must point to MAX_NPAR*MAX_PAYLOAD_SIZE bytes.
+	int encode_frame(const void *payload, int payload_size, encoded_frame *out, float protection = 1.0f, int subframe_count = 1);
+	int transmit_frame(const encoded_frame *frame);
+
+	// statistics since start.
+	virtual int get_stats(sender_stats *stats);
 protected:
 
+	// encode and send one FEC block, overridden by asynchronous senders.
+	virtual int submit_frame(const void *payload, int payload_size, float protection, int subframe_count);
+	int flush_block();
+
+	void build_header(packet_header *header, const encoded_frame *frame, int packet_id);
+
+	// stats are written by encode_frame() and transmit_frame(),
+	// senders running them on different threads guard stats with these.
+	virtual void lock_stats(){}
+	virtual void unlock_stats(){}
+
 	int packet_payload_size;
 	float parity_ratio;
+	RedundancyController *redundancy;
 
 	raw_packet *packets;
+	encoded_frame *current;
+	rsEncoder header_rs_encoder;
 	uint8_t frame_id;
 	HAL::IBlockDevice *block_sender;
-};
\ No newline at end of file
+
+	// long block state
+	int long_block_frames;
+	int long_block_delay;
+	int small_frame_packets;
+	int max_block_packets;
+	uint8_t *block_buffer;
+	int block_size;
+	int block_frames;
+	float block_protection;
+	int64_t block_start_time;
+
+	sender_stats stats;
+};
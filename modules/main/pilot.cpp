@@ -53,6 +53,7 @@ static param ignore_error("err",0);
 static param rookie_mode("rook",0);
 static param selfie_mode("self", 0);
 static param rc_mode("mode", 1);
+static param imu_burst_on_arm("imuB", 0);		// seconds of full rate raw imu capture started on arming, 0 to disable
 static param low_voltage_setting1("lp1", 11.0f);
 static param low_voltage_setting2("lp2", 10.8f);
 static param fixed_wing("fix", 0);
@@ -941,6 +942,8 @@ int yet_another_pilot::save_logs()
 		log2(raw_imu_data, 5, sizeof(raw_imu_data));
 	}
 
+	imu_burst.flush();
+
 	
 	return 0;
 }
@@ -1263,8 +1266,12 @@ int yet_another_pilot::read_imu_and_filter()
 	int16_t data[6] = {acc.V.x * 100, acc.V.y * 100, acc.V.z * 100,
 						gyro.V.x * 1800 / PI, gyro.V.y * 1800 / PI, gyro.V.z * 1800 / PI,};
 
+	// a full rate capture replaces the stream while it runs.
+	imu_burst.add(acc.array, gyro.array, reading_start);
+
 	//log2(data, 5, sizeof(data));
-	raw_imu_buffer.put(data, sizeof(data));
+	if (!imu_burst.active())
+		raw_imu_buffer.put(data, sizeof(data));
 
 	// voltage and current sensors	
 	float alpha = interval / (interval + 1.0f/(2*PI * 2.0f));		// 2hz low pass filter
@@ -1783,6 +1790,9 @@ int yet_another_pilot::arm(bool arm /*= true*/, bool forced /*= false*/)
 	armed = arm;
 	last_arming_time = systimer->gettime();
 	execute_mode_switching();
+
+	if (arm && imu_burst_on_arm > 0)
+		imu_burst.start((int64_t)(imu_burst_on_arm * 1000000));
 	
 	LOGE("%s OK\n", arm ? "arm" : "disarm");
 	
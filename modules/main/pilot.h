@@ -20,6 +20,7 @@
 #include <Algorithm/pos_estimator2.h>
 #include <math/LowPassFilter2p.h>
 #include <utils/fifo2.h>
+#include <utils/imu_capture.h>
 #include <utils/ymodem.h>
 
 #include "mode_basic.h"
@@ -216,6 +217,7 @@ public:
 	float home[2];
 	float home_set;
 	FIFO<2048> raw_imu_buffer;
+	imu_capture imu_burst;		// full rate raw imu capture, see TAG_IMU_BURST
 	bool firmware_loading;		// loading firmware from uart
 	bool mag_reset_requested;
 	motion_detector detect_acc;
@@ -253,6 +253,25 @@ extern "C" int parse_command_line(const char *line, char *out)
 			yap.usb_data_publish = 0xff;
 		}
 	}
+	else if (strstr(line, "imuburst") == line)
+	{
+		// "imuburst,N": capture raw imu samples for N seconds, "imuburst": until "imuburst,0"
+		if (strstr(line, "imuburst,") == line)
+		{
+			float seconds = atof(line+9);
+			if (seconds > 0)
+				yap.imu_burst.start((int64_t)(seconds * 1000000));
+			else
+				yap.imu_burst.stop();
+		}
+		else
+		{
+			yap.imu_burst.start(0);
+		}
+
+		strcpy(out, "ok\n");
+		return 3;
+	}
 	else if (strstr(line, "gps") == line)
 	{
 		devices::IGPS *gps = manager.get_GPS(0);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+// wakes a consumer thread blocked until producer threads publish data.
+// producers call ring() after publishing, which is a fence and a load while nobody waits.
+// several producers may share one doorbell, so one consumer can wait on all of them.
+class Doorbell
+{
+public:
+	Doorbell()
+	{
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&cond, &attr);
+		pthread_condattr_destroy(&attr);
+		pthread_mutex_init(&cs, NULL);
+		waiting = 0;
+	}
+	~Doorbell()
+	{
+		pthread_mutex_destroy(&cs);
+		pthread_cond_destroy(&cond);
+	}
+
+	// producer: wake the consumer if it is waiting.
+	void ring()
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&waiting, __ATOMIC_SEQ_CST))
+		{
+			pthread_mutex_lock(&cs);
+			pthread_cond_signal(&cond);
+			pthread_mutex_unlock(&cs);
+		}
+	}
+
+	// consumer: wait up to timeout(us) until ready(p) returns non zero, returns the last ready(p).
+	int wait(int timeout, int (*ready)(void *p), void *p)
+	{
+		int r = ready(p);
+		if (r)
+			return r;
+
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += timeout / 1000000;
+		ts.tv_nsec += (timeout % 1000000) * 1000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		// producers signal only while waiting is set, and check it after publishing.
+		pthread_mutex_lock(&cs);
+		__atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		while ((r = ready(p)) == 0)
+		{
+			if (pthread_cond_timedwait(&cond, &cs, &ts) == ETIMEDOUT)
+				break;
+		}
+		__atomic_store_n(&waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&cs);
+
+		return ready(p);
+	}
+
+protected:
+	pthread_mutex_t cs;
+	pthread_cond_t cond;
+	int waiting;
+};
@@ -1,67 +1,151 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
 
-template<int buffer_size>
+// orders ring data accesses against the index store/load that hands them to the other side.
+#if defined(__CC_ARM)
+#define FIFO_BARRIER() __dmb(0xF)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define FIFO_BARRIER() _ReadWriteBarrier()
+#else
+#define FIFO_BARRIER() __sync_synchronize()
+#endif
+
+// byte ring buffer, lock free for one producer and one consumer (e.g. an interrupt and the main loop).
+// head and tail are free running counters, each written by one side only.
+// every operation moves data with at most two memcpy, one per side of the wrap around.
+template<int buffer_size>		// power of 2
 class FIFO
 {
 public:
-	FIFO():start(0),end(0){}
+	// a reserved area, split in two where it wraps around. size[1] is 0 if it does not.
+	typedef struct
+	{
+		uint8_t *p[2];
+		int size[2];
+	} segments;
+
+	FIFO():head(0),tail(0){}
 	~FIFO(){}
 
+	// consumer
 	int pop(void *out, int maxcount)
 	{
-		char *p = (char*)out;
-		int size = count();
-		if (maxcount > size)
-			maxcount = size;
-		for(int i=0; i<maxcount; i++)
-			p[i] = buffer[(i+start)%buffer_size];
-		start = (maxcount+start)%buffer_size;
+		maxcount = peak(out, maxcount);
+		skip(maxcount);
 		return maxcount;
 	}
-	
+
 	int peak(void *out, int maxcount)
 	{
-		char *p = (char*)out;
 		int size = count();
 		if (maxcount > size)
 			maxcount = size;
-		for(int i=0; i<maxcount; i++)
-			p[i] = buffer[(i+start)%buffer_size];
+		FIFO_BARRIER();
+
+		int start = tail & (buffer_size-1);
+		int first = buffer_size - start;
+		if (first > maxcount)
+			first = maxcount;
+		memcpy(out, buffer+start, first);
+		memcpy((uint8_t*)out+first, buffer, maxcount-first);
 		return maxcount;
 	}
-	
+
+	// consumer, zero copy: readable bytes in one piece at *p, the rest follows at the start of the buffer.
+	// call skip() after using them.
+	int front(const void **p)
+	{
+		int size = count();
+		FIFO_BARRIER();
+
+		int start = tail & (buffer_size-1);
+		*p = buffer + start;
+		return size < buffer_size - start ? size : buffer_size - start;
+	}
+
+	int skip(int count)
+	{
+		FIFO_BARRIER();
+		tail += count;
+		return count;
+	}
+
+	// producer, returns count or -1 if there is not enough room, nothing is written then.
 	int put(const void *data, int count)
 	{
-		if (available() < count)
+		segments s;
+		if (reserve(count, &s) < 0)
 			return -1;
 
-		const char *p = (const char*)data;
-		for(int i=0; i<count; i++)
-			buffer[(end+i)%buffer_size] = p[i];
-		
-		end = (end + count) % buffer_size;
+		write(&s, 0, data, count);
+		commit(count);
 
 		return count;
 	}
-	
+
+	// producer, zero copy: reserve count bytes, fill them in place (e.g. with write()), then commit(count).
+	// the consumer sees nothing of them before commit(), so a record of several parts arrives as a whole.
+	// returns 0, -1 if there is not enough room.
+	int reserve(int count, segments *s)
+	{
+		if (count < 0 || available() < count)
+			return -1;
+		FIFO_BARRIER();
+
+		int start = head & (buffer_size-1);
+		int first = buffer_size - start;
+		if (first > count)
+			first = count;
+		s->p[0] = buffer + start;
+		s->size[0] = first;
+		s->p[1] = buffer;
+		s->size[1] = count - first;
+
+		return 0;
+	}
+
+	int commit(int count)
+	{
+		FIFO_BARRIER();
+		head += count;
+		return count;
+	}
+
+	// copy data to offset of a reserved area.
+	static void write(segments *s, int offset, const void *data, int size)
+	{
+		const uint8_t *p = (const uint8_t*)data;
+		if (offset < s->size[0])
+		{
+			int first = s->size[0] - offset;
+			if (first > size)
+				first = size;
+			memcpy(s->p[0] + offset, p, first);
+			p += first;
+			size -= first;
+			offset += first;
+		}
+		memcpy(s->p[1] + offset - s->size[0], p, size);
+	}
+
+	// both sides
 	int count()
 	{
-		int _end = end;
-		int size = _end - start;
-		if (size<0)
-			size += buffer_size;
-		return size;
+		return (uint32_t)(head - tail);
 	}
-	
+
 	int available()
 	{
-		return buffer_size - count() - 1;
+		return buffer_size - count();
 	}
 
 protected:
+	typedef char buffer_size_must_be_power_of_2[(buffer_size & (buffer_size-1)) == 0 ? 1 : -1];
+
 	uint8_t buffer[buffer_size];
-	int start;
-	int end;
+	volatile uint32_t head;		// written by producer
+	volatile uint32_t tail;		// written by consumer
 };
@@ -0,0 +1,124 @@
+#include "imu_capture.h"
+#include "fifo2.h"
+#include "log.h"
+
+static int16_t quantize(float v, float scale)
+{
+	v *= scale;
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return (int16_t)(v > 0 ? v + 0.5f : v - 0.5f);
+}
+
+imu_capture::imu_capture()
+:ready(-1)
+,request(0)
+,request_ms(-1)
+,request_seen(0)
+,running(false)
+,current(0)
+,end(0)
+,counter(0)
+,burst(0)
+{
+	blocks[0].header.count = blocks[1].header.count = 0;
+}
+
+void imu_capture::start(int64_t duration)
+{
+	int64_t ms = duration > 0 ? (duration + 999) / 1000 : 0;
+	request_ms = ms < 0x7fffffff ? (int32_t)ms : 0x7fffffff;
+	FIFO_BARRIER();
+	request++;
+}
+
+void imu_capture::stop()
+{
+	request_ms = -1;
+	FIFO_BARRIER();
+	request++;
+}
+
+int imu_capture::flush()
+{
+	int i = ready;
+	if (i < 0)
+		return 0;
+	FIFO_BARRIER();
+
+	const block &b = blocks[i];
+	log2(&b, TAG_IMU_BURST, sizeof(imu_burst_header) + b.header.count * sizeof(imu_burst_sample));
+
+	FIFO_BARRIER();
+	ready = -1;
+	return 1;
+}
+
+// hand the current block to flush(), or drop its samples if the last one is still waiting.
+void imu_capture::handover()
+{
+	block &b = blocks[current];
+	if (b.header.count == 0)
+		return;
+
+	if (ready < 0)
+	{
+		FIFO_BARRIER();
+		ready = current;
+		current ^= 1;
+	}
+	blocks[current].header.count = 0;
+}
+
+void imu_capture::add(const float accel[3], const float gyro[3], int64_t time)
+{
+	if (request != request_seen)
+	{
+		request_seen = request;
+		FIFO_BARRIER();
+		int32_t ms = request_ms;
+
+		if (running)
+			handover();
+		running = ms >= 0;
+		if (running)
+		{
+			end = ms > 0 ? time + (int64_t)ms * 1000 : 0;
+			counter = 0;
+			burst++;
+			blocks[current].header.count = 0;
+		}
+	}
+
+	if (!running)
+		return;
+
+	if (end && time >= end)
+	{
+		handover();
+		running = false;
+		return;
+	}
+
+	block &b = blocks[current];
+	if (b.header.count == 0)
+	{
+		b.header.counter = counter;
+		b.header.burst = burst;
+		b.header.first = time;
+	}
+
+	imu_burst_sample &s = b.samples[b.header.count++];
+	for(int i=0; i<3; i++)
+	{
+		s.accel[i] = quantize(accel[i], IMU_BURST_ACCEL_SCALE);
+		s.gyro[i] = quantize(gyro[i], IMU_BURST_GYRO_SCALE);
+	}
+	b.header.last = time;
+	counter++;
+
+	if (b.header.count == IMU_CAPTURE_BLOCK)
+		handover();
+}
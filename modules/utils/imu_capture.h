@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <Protocol/RFData.h>
+
+#define IMU_CAPTURE_BLOCK 64		// samples per TAG_IMU_BURST record
+
+// captures every raw imu sample for vibration analysis and filter design, logged as TAG_IMU_BURST records.
+// add() runs in the imu context and fills one of two blocks, flush() logs a full block from the main loop.
+// only one block waits for flush() at a time, if the main loop falls behind the samples are lost
+// and the counter of the next block shows how many.
+class imu_capture
+{
+public:
+	imu_capture();
+	~imu_capture(){}
+
+	// main loop
+	// capture for duration us, 0: until stop(). a running capture is restarted.
+	void start(int64_t duration);
+	void stop();
+	bool active(){return running;}
+
+	// log the block waiting, if any. returns 1 if one was logged, 0 otherwise.
+	int flush();
+
+	// imu context
+	void add(const float accel[3], const float gyro[3], int64_t time);
+
+protected:
+	void handover();
+
+	typedef struct
+	{
+		imu_burst_header header;
+		imu_burst_sample samples[IMU_CAPTURE_BLOCK];
+	} block;
+
+	block blocks[2];
+	volatile int ready;					// block waiting for flush(), -1 if none. set by add(), cleared by flush()
+
+	// requests from the main loop, taken by add()
+	volatile uint32_t request;
+	volatile int32_t request_ms;		// -1: stop, 0: until stopped, duration otherwise
+
+	// imu context
+	uint32_t request_seen;
+	volatile bool running;
+	int current;
+	int64_t end;
+	uint32_t counter;
+	uint16_t burst;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+// binary statistics records of the video link, for logging and on-screen overlay.
+// every record starts with a stats_header, counters are accumulated since start,
+// per-second figures are the difference of two records.
+// all fields are fixed size and naturally aligned, records can be written to a file as is.
+
+#define STATS_MAGIC 0x5453			// "ST"
+#define LATENCY_BUCKETS 21
+
+enum stats_type
+{
+	stats_apcap_rx = 1,
+	stats_sender = 2,
+	stats_reciever = 3,
+	stats_message_link = 4,
+};
+
+typedef struct
+{
+	uint16_t magic;				// STATS_MAGIC
+	uint8_t type;				// stats_type
+	uint8_t version;
+	uint16_t size;				// bytes of the whole record
+	uint16_t reserved;
+	int64_t timestamp;			// us, CLOCK_MONOTONIC
+} stats_header;
+
+// log2 latency histogram: bucket 0 counts 0us, bucket i counts [2^(i-1), 2^i) us, the last bucket everything above.
+typedef struct
+{
+	uint32_t buckets[LATENCY_BUCKETS];
+} latency_histogram;
+
+static inline void latency_histogram_add(latency_histogram *h, int64_t us)
+{
+	int i = 0;
+	while (us > 0 && i < LATENCY_BUCKETS-1)
+	{
+		us >>= 1;
+		i++;
+	}
+	h->buckets[i]++;
+}
+
+// upper bound(us) of the bucket holding the given fraction (0~1) of the samples, -1 if empty.
+static inline int64_t latency_histogram_percentile(const latency_histogram *h, float fraction)
+{
+	uint32_t total = 0;
+	for(int i=0; i<LATENCY_BUCKETS; i++)
+		total += h->buckets[i];
+	if (total == 0)
+		return -1;
+
+	uint32_t sum = 0;
+	for(int i=0; i<LATENCY_BUCKETS; i++)
+	{
+		sum += h->buckets[i];
+		if (sum >= total * fraction)
+			return (int64_t)1 << i;
+	}
+	return (int64_t)1 << (LATENCY_BUCKETS-1);
+}
+
+static inline void stats_fill_header(stats_header *h, int type, int size, int64_t timestamp)
+{
+	h->magic = STATS_MAGIC;
+	h->type = type;
+	h->version = 1;
+	h->size = size;
+	h->reserved = 0;
+	h->timestamp = timestamp;
+}
@@ -9,6 +9,9 @@
 
 #include <FileSystem/ff.h>
 #include <utils/fifo2.h>
+#include <utils/log_block.h>
+#include <utils/log_drop.h>
+#include <utils/param.h>
 #include <Protocol/RFData.h>
 #include <Protocol/common.h>
 #include <HAL/Interface/Interfaces.h>
@@ -26,7 +29,26 @@ uint32_t lost1 = 0;		// buffer full
 bool storage_ready = true;
 volatile bool buffer_locked = false;
 
-__attribute__((section("dma"))) FIFO<16384> buffer;
+// the ring lives in DMA reachable RAM by default, so pieces go to the SD card straight from it.
+// LOG_BUFFER_CCM moves it to CCM instead, leaving room for a larger LOG_BUFFER_SIZE at the cost of a copy per piece.
+#ifdef LOG_BUFFER_CCM
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 32768
+#endif
+FASTMEM FIFO<LOG_BUFFER_SIZE> buffer;
+#else
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 16384
+#endif
+__attribute__((section("dma"))) FIFO<LOG_BUFFER_SIZE> buffer;
+#endif
+typedef FIFO<LOG_BUFFER_SIZE> log_fifo;
+static log_drop_counter drops;
+static param log_compression("logz", 0);		// 1: write compressed blocks (see log_block.h), read once so a file is never mixed
+static uint8_t lzo_wrkmem[LOG_BLOCK_WRKMEM];
+static log_block_encoder encoder(lzo_wrkmem);
+__attribute__((section("dma"))) static uint8_t block[LOG_BLOCK_MAX_SIZE];
+static int compressed = -1;		// latched for the whole file at its first flush
 int last_log_flush_time = -999999;
 int file_number = 0;
 bool log_ready()
@@ -68,6 +90,130 @@ int log_init()
 	return 0;
 }
 
+// contiguous mode: the log file is preallocated in one piece when it is opened and written sector-wise straight to the card,
+// so FatFs does no FAT updates or partial sector read-modify-writes while logging, only a size update every second.
+// when the area is full, the file grows through f_write() as before.
+#define SECTOR_SIZE 512
+static param log_preallocate("logp", 0);		// MB to preallocate for the log file, 0: grow it through f_write()
+__attribute__((section("dma"))) static uint8_t stage[4096];		// multiple of SECTOR_SIZE, so cluster aligned writes stay aligned
+static int staged = 0;
+static DWORD next_sector = 0;					// 0: not in contiguous mode
+static DWORD end_sector = 0;
+static DWORD contiguous_size = 0;				// bytes logged in contiguous mode
+
+static int preallocate(FIL *f)
+{
+	int mb = float(log_preallocate);
+	if (mb <= 0)
+		return -1;
+	if (mb > 4095)
+		mb = 4095;				// FAT32 file size limit
+	DWORD size = (DWORD)mb << 20;
+	if (f_expand(f, size, 1) != FR_OK)
+	{
+		LOGE("no contiguous %dMB for logging\n", mb);
+		return -1;
+	}
+
+	// nothing logged yet, the size grows with the periodic updates.
+	f->fsize = 0;
+	f->flag |= FA__WRITTEN;
+	if (f_sync(f) != FR_OK)
+		return -1;
+
+	next_sector = clust2sect(f->fs, f->sclust);
+	end_sector = next_sector + size / SECTOR_SIZE;
+	contiguous_size = 0;
+	staged = 0;
+	LOGE("preallocated %dMB for logging\n", mb);
+
+	return 0;
+}
+
+// write the stage as whole sectors, a partly filled last sector is written padded and once more when it is complete.
+static int write_stage(bool partial)
+{
+	int sectors = (partial ? staged + SECTOR_SIZE - 1 : staged) / SECTOR_SIZE;
+	if (sectors == 0)
+		return 0;
+
+	if (disk_write(0, stage, next_sector, sectors) != RES_OK)
+		return -1;
+
+	if (!partial)
+	{
+		next_sector += sectors;
+		staged = 0;
+	}
+
+	return 0;
+}
+
+// the area is full: the rest goes through FatFs, appended to the area's cluster chain.
+static int end_contiguous(FIL *f)
+{
+	next_sector = 0;
+	f->fsize = contiguous_size;
+	f->flag |= FA__WRITTEN;
+	if (f_sync(f) != FR_OK || f_lseek(f, contiguous_size) != FR_OK)
+		return -1;
+
+	return 0;
+}
+
+static int write_contiguous(FIL *f, const void *data, int size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	while (size > 0)
+	{
+		int n = sizeof(stage) - staged;
+		if (n > size)
+			n = size;
+		memcpy(stage + staged, p, n);
+		staged += n;
+		p += n;
+		size -= n;
+
+		if (staged == sizeof(stage))
+		{
+			if (next_sector + sizeof(stage) / SECTOR_SIZE > end_sector)
+			{
+				if (end_contiguous(f) < 0)
+					return -1;
+				unsigned int done;
+				if (f_write(f, stage, sizeof(stage), &done) != FR_OK || done != sizeof(stage))
+					return -1;
+				staged = 0;
+				break;
+			}
+
+			if (write_stage(false) < 0)
+				return -1;
+			contiguous_size += sizeof(stage);
+		}
+	}
+
+	if (size > 0 && next_sector == 0)
+	{
+		unsigned int done;
+		if (f_write(f, p, size, &done) != FR_OK || done != size)
+			return -1;
+	}
+
+	return 0;
+}
+
+// periodic size update of a contiguous log file.
+static int sync_contiguous(FIL *f)
+{
+	if (write_stage(true) < 0)
+		return -1;
+
+	f->fsize = contiguous_size + staged;
+	f->flag |= FA__WRITTEN;
+	return f_sync(f) == FR_OK ? 0 : -1;
+}
+
 int write_to_disk(void *data, int size)
 {
 	int64_t us = systimer->gettime();
@@ -93,6 +239,7 @@ int write_to_disk(void *data, int size)
 					UINT tmp;
 					f_write(&yap_file, &done, 4, &tmp);
 					f_sync(&yap_file);
+					preallocate(file);
 					break;
 				}
 			}
@@ -100,16 +247,30 @@ int write_to_disk(void *data, int size)
 
 		if (storage_ready && file)
 		{
-			unsigned int done;
-			if (f_write(file, data, size, &done) != FR_OK || done !=size)
+			if (next_sector)
 			{
-				LOGE("\r\nSDCARD ERROR\r\n");
-				storage_ready = false;
+				if (write_contiguous(file, data, size) < 0)
+				{
+					LOGE("\r\nSDCARD ERROR\r\n");
+					storage_ready = false;
+				}
+			}
+			else
+			{
+				unsigned int done;
+				if (f_write(file, data, size, &done) != FR_OK || done !=size)
+				{
+					LOGE("\r\nSDCARD ERROR\r\n");
+					storage_ready = false;
+				}
 			}
 			if (systimer->gettime() - last_log_flush_time > 1000000)
 			{
 				last_log_flush_time = systimer->gettime();
-				f_sync(file);
+				if (next_sector)
+					sync_contiguous(file);
+				else
+					f_sync(file);
 			}
 		}
 	}
@@ -131,13 +292,104 @@ int log_flush()
 	if (buffer.count() == 0)
 		return 1;
 
-	int count = buffer.count();
-	uint8_t piece[2048];
-	int piece_count = (count) / sizeof(piece);
-	for(int i=0; i<piece_count; i++)
+	if (compressed < 0)
+		compressed = float(log_compression) > 0.5f;
+
+	// pieces leave the ring in 2048 byte steps and its size is a multiple of that,
+	// so a whole piece is always contiguous and is written (or compressed) straight from the ring.
+	const int piece_size = LOG_BLOCK_MAX_RAW;
+	while (buffer.count() >= piece_size)
+	{
+		const void *piece;
+		if (buffer.front(&piece) < piece_size)
+			break;
+		if (compressed)
+		{
+			write_to_disk(block, encoder.encode(piece, piece_size, block));
+		}
+		else
+		{
+#ifdef LOG_BUFFER_CCM
+			memcpy(block, piece, piece_size);
+			piece = block;
+#endif
+			write_to_disk((void*)piece, piece_size);
+		}
+		buffer.skip(piece_size);
+	}
+
+	return 0;
+}
+
+// put header and payload into the ring as one record, if it leaves the headroom of its priority free.
+// the caller holds buffer_locked.
+static int put_record(const void *header, int header_size, const void *payload, int payload_size, int priority)
+{
+	int size = header_size + payload_size;
+	log_fifo::segments record;
+	if (buffer.available() - size < log_headroom(priority, LOG_BUFFER_SIZE) || buffer.reserve(size, &record) < 0)
+		return -1;
+
+	log_fifo::write(&record, 0, header, header_size);
+	if (payload_size > 0)
+		log_fifo::write(&record, header_size, payload, payload_size);
+	buffer.commit(size);
+
+	return 0;
+}
+
+// report earlier drops in front of the next record once the ring is as empty as text logs need it,
+// so a stall ends in one marker (first and last tell its span) rather than one between every two records that still fit.
+static void put_drop_marker()
+{
+	if (!drops.pending())
+		return;
+
+	uint8_t marker[LOG_DROP_MAX_MARKER];
+	uint16_t size = drops.marker(marker);
+	uint16_t tag = TAG_LOG_DROPPED;
+	int64_t timestamp = systimer->gettime();
+	timestamp &= ~((uint64_t)0xff << 56);
+	timestamp |= (uint64_t)TAG_EXTENDED_DATA << 56;
+
+	uint8_t header[12];
+	memcpy(header, &timestamp, 8);
+	memcpy(header+8, &tag, 2);
+	memcpy(header+10, &size, 2);
+	if (put_record(header, 12, marker, size, log_priority_low) == 0)
+		drops.reported();
+}
+
+// tag, extended tag and timestamp of a record from its first bytes.
+static void parse_record(const uint8_t *header, int size, uint8_t *tag, uint16_t *tag_ex, int64_t *timestamp)
+{
+	*tag = 0;
+	*tag_ex = 0xffff;
+	*timestamp = 0;
+	if (size < 8)
+		return;
+
+	memcpy(timestamp, header, 8);
+	*tag = (uint64_t)*timestamp >> 56;
+	*timestamp &= ~((uint64_t)0xff << 56);
+	if (*tag == TAG_EXTENDED_DATA && size >= 10)
+		memcpy(tag_ex, header+8, 2);
+}
+
+// the caller holds buffer_locked.
+static int enqueue(const void *header, int header_size, const void *payload, int payload_size, int priority)
+{
+	put_drop_marker();
+
+	if (put_record(header, header_size, payload, payload_size, priority) < 0)
 	{
-		int piece_size = buffer.pop(piece, sizeof(piece));
-		write_to_disk(piece, piece_size);
+		uint8_t tag;
+		uint16_t tag_ex;
+		int64_t timestamp;
+		parse_record((const uint8_t*)header, header_size, &tag, &tag_ex, &timestamp);
+		drops.dropped(tag, tag_ex, header_size + payload_size, timestamp);
+		lost1++;
+		return -1;
 	}
 
 	return 0;
@@ -145,18 +397,24 @@ int log_flush()
 
 int log(const void *data, int size)
 {
+	uint8_t tag;
+	uint16_t tag_ex;
+	int64_t timestamp;
+	parse_record((const uint8_t*)data, size, &tag, &tag_ex, &timestamp);
+	int priority = log_record_priority(tag, tag_ex);
+
 	if (buffer_locked)
+	{
+		drops.busy(priority);
 		return -1;
+	}
 
 	buffer_locked = true;
 
-	int res = buffer.put(data, size);
+	enqueue(data, size, NULL, 0, priority);
 
 	buffer_locked = false;
 	
-	if (res < 0)
-		lost1++;
-	
 	return 0;
 }
 
@@ -168,30 +426,29 @@ int log_write(const void *data, int size)
 
 int log2(const void *packet, uint16_t tag, uint16_t size)
 {
+	int priority = log_record_priority(TAG_EXTENDED_DATA, tag);
 	if (buffer_locked)
+	{
+		drops.busy(priority);
 		return -1;
+	}
 
 	buffer_locked = true;
 
-	if (buffer.available() < size+8+4) 
-	{
-		lost1++;
-		buffer_locked = false;
-		return -1;
-	}
-	
+	// header and payload are committed as one record.
 	int64_t timestamp = systimer->gettime();
 	timestamp &= ~((uint64_t)0xff << 56);
 	timestamp |= (uint64_t)TAG_EXTENDED_DATA << 56;
 
-	buffer.put(&timestamp, 8);
-	buffer.put(&tag, 2);
-	buffer.put(&size, 2);
-	buffer.put(packet, size);
+	uint8_t header[12];
+	memcpy(header, &timestamp, 8);
+	memcpy(header+8, &tag, 2);
+	memcpy(header+10, &size, 2);
+	int res = enqueue(header, 12, packet, size, priority);
 
 	buffer_locked = false;
 
-	return 0;
+	return res;
 }
 
 int log(const void *packet, uint8_t tag, int64_t timestamp)
@@ -3,6 +3,9 @@
 #include <string.h>
 #include <pthread.h>
 #include <utils/fifo2.h>
+#include <utils/log_block.h>
+#include <utils/log_drop.h>
+#include <utils/param.h>
 #include <Protocol/RFData.h>
 #include <Protocol/common.h>
 #include <HAL/Interface/Interfaces.h>
@@ -16,7 +19,17 @@ uint32_t lost1 = 0; //buffer full
 bool storage_ready = true;
 volatile bool buffer_locked = false;
 
-FIFO<16384> buffer;
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 16384
+#endif
+FIFO<LOG_BUFFER_SIZE> buffer;
+typedef FIFO<LOG_BUFFER_SIZE> log_fifo;
+static log_drop_counter drops;
+static param log_compression("logz", 0);	// 1: write compressed blocks (see log_block.h), read once so a file is never mixed
+static uint8_t lzo_wrkmem[LOG_BLOCK_WRKMEM];
+static log_block_encoder encoder(lzo_wrkmem);
+static uint8_t block[LOG_BLOCK_MAX_SIZE];
+static int compressed = -1;
 int last_log_flush_time = -999999;
 int file_number = 0;
 
@@ -106,13 +119,95 @@ int log_flush()
 {
 	if(buffer.count() == 0)
 		return 1;
-	int count = buffer.count();
-	uint8_t piece[2048];
-	int piece_count = (count) / sizeof(piece);
-	for(int i=0;i<piece_count;i++)
+	if(compressed < 0)
+		compressed = float(log_compression) > 0.5f;
+	// pieces leave the ring in 2048 byte steps and its size is a multiple of that,
+	// so a whole piece is always contiguous and is written (or compressed) straight from the ring.
+	const int piece_size = LOG_BLOCK_MAX_RAW;
+	while(buffer.count() >= piece_size)
 	{
-		int piece_size = buffer.pop(piece,sizeof(piece));
-		write_to_disk(piece,piece_size);
+		const void *piece;
+		if(buffer.front(&piece) < piece_size)
+			break;
+		if(compressed)
+			write_to_disk(block,encoder.encode(piece,piece_size,block));
+		else
+			write_to_disk((void*)piece,piece_size);
+		buffer.skip(piece_size);
+	}
+
+	return 0;
+}
+
+// put header and payload into the ring as one record, if it leaves the headroom of its priority free.
+// the caller holds buffer_locked.
+static int put_record(const void *header, int header_size, const void *payload, int payload_size, int priority)
+{
+	int size = header_size + payload_size;
+	log_fifo::segments record;
+	if (buffer.available() - size < log_headroom(priority, LOG_BUFFER_SIZE) || buffer.reserve(size, &record) < 0)
+		return -1;
+
+	log_fifo::write(&record, 0, header, header_size);
+	if (payload_size > 0)
+		log_fifo::write(&record, header_size, payload, payload_size);
+	buffer.commit(size);
+
+	return 0;
+}
+
+// report earlier drops in front of the next record once the ring is as empty as text logs need it,
+// so a stall ends in one marker (first and last tell its span) rather than one between every two records that still fit.
+static void put_drop_marker()
+{
+	if (!drops.pending())
+		return;
+
+	uint8_t marker[LOG_DROP_MAX_MARKER];
+	uint16_t size = drops.marker(marker);
+	uint16_t tag = TAG_LOG_DROPPED;
+	int64_t timestamp = systimer->gettime();
+	timestamp &= ~((uint64_t)0xff << 56);
+	timestamp |= (uint64_t)TAG_EXTENDED_DATA << 56;
+
+	uint8_t header[12];
+	memcpy(header, &timestamp, 8);
+	memcpy(header+8, &tag, 2);
+	memcpy(header+10, &size, 2);
+	if (put_record(header, 12, marker, size, log_priority_low) == 0)
+		drops.reported();
+}
+
+// tag, extended tag and timestamp of a record from its first bytes.
+static void parse_record(const uint8_t *header, int size, uint8_t *tag, uint16_t *tag_ex, int64_t *timestamp)
+{
+	*tag = 0;
+	*tag_ex = 0xffff;
+	*timestamp = 0;
+	if (size < 8)
+		return;
+
+	memcpy(timestamp, header, 8);
+	*tag = (uint64_t)*timestamp >> 56;
+	*timestamp &= ~((uint64_t)0xff << 56);
+	if (*tag == TAG_EXTENDED_DATA && size >= 10)
+		memcpy(tag_ex, header+8, 2);
+}
+
+// the caller holds buffer_locked.
+static int enqueue(const void *header, int header_size, const void *payload, int payload_size, int priority)
+{
+	put_drop_marker();
+
+	if (put_record(header, header_size, payload, payload_size, priority) < 0)
+	{
+		uint8_t tag;
+		uint16_t tag_ex;
+		int64_t timestamp;
+		parse_record((const uint8_t*)header, header_size, &tag, &tag_ex, &timestamp);
+		drops.dropped(tag, tag_ex, header_size + payload_size, timestamp);
+		lost1++;
+		return -1;
 	}
 
 	return 0;
@@ -120,14 +215,24 @@ int log_flush()
 
 int log(const void *data, int size)
 {
-	// enqueue
-	if(buffer_locked)
+	uint8_t tag;
+	uint16_t tag_ex;
+	int64_t timestamp;
+	parse_record((const uint8_t*)data, size, &tag, &tag_ex, &timestamp);
+	int priority = log_record_priority(tag, tag_ex);
+
+	if (buffer_locked)
+	{
+		drops.busy(priority);
 		return -1;
+	}
+
 	buffer_locked = true;
-	int res = buffer.put(data,size);
+
+	enqueue(data, size, NULL, 0, priority);
+
 	buffer_locked = false;
-	if(res < 0)
-		lost1++;
+	
 	return 0;
 }
 
@@ -138,30 +243,30 @@ int log_write(const void *data, int size)
 
 
 int log2(const void *packet, uint16_t tag, uint16_t size)
-{	
-	if(buffer_locked)
-		return -1;
-	buffer_locked = true;
-	
-	if(buffer.available() < size+8+4)
+{
+	int priority = log_record_priority(TAG_EXTENDED_DATA, tag);
+	if (buffer_locked)
 	{
-		lost1++;
-		buffer_locked = false;
+		drops.busy(priority);
 		return -1;
 	}
 
+	buffer_locked = true;
+
+	// header and payload are committed as one record.
 	int64_t timestamp = systimer->gettime();
 	timestamp &= ~((uint64_t)0xff << 56);
 	timestamp |= (uint64_t)TAG_EXTENDED_DATA << 56;
 
-	// enqueue
- 	buffer.put(&timestamp, 8);
- 	buffer.put(&tag, 2);
- 	buffer.put(&size, 2);
- 	buffer.put(packet, size);
+	uint8_t header[12];
+	memcpy(header, &timestamp, 8);
+	memcpy(header+8, &tag, 2);
+	memcpy(header+10, &size, 2);
+	int res = enqueue(header, 12, packet, size, priority);
 
 	buffer_locked = false;
-	return 0;
+
+	return res;
 }
 
 int log(const void *packet, uint8_t tag, int64_t timestamp)
@@ -0,0 +1,372 @@
+#include "log_block.h"
+#include <stddef.h>
+#include <string.h>
+#include <Protocol/crc32.h>
+#include <Protocol/RFData.h>
+#include "minilzo.h"
+
+#define FIXED_RECORD_SIZE 32			// timestamp(8) + 24 byte data
+#define EXTENDED_HEADER_SIZE 12			// timestamp(8) + tag(2) + size(2)
+
+// records are not aligned in the stream.
+static uint16_t get16(const uint8_t *p){uint16_t v; memcpy(&v, p, 2); return v;}
+static uint32_t get32(const uint8_t *p){uint32_t v; memcpy(&v, p, 4); return v;}
+static void put16(uint8_t *p, uint16_t v){memcpy(p, &v, 2);}
+static void put32(uint8_t *p, uint32_t v){memcpy(p, &v, 4);}
+
+// header bytes needed to know the size of the record starting with these header_size bytes.
+static int header_length(const uint8_t *header, int header_size)
+{
+	if (header_size < 8)
+		return 8;
+
+	return header[7] == TAG_EXTENDED_DATA ? EXTENDED_HEADER_SIZE : 8;
+}
+
+static int record_size(const uint8_t *header)
+{
+	if (header[7] != TAG_EXTENDED_DATA)
+		return FIXED_RECORD_SIZE;
+
+	return EXTENDED_HEADER_SIZE + get16(header+10);
+}
+
+// the record's key for delta coding, tag and size must match.
+static uint32_t record_key(const uint8_t *record)
+{
+	if (record[7] != TAG_EXTENDED_DATA)
+		return record[7];
+
+	return (uint32_t)TAG_EXTENDED_DATA << 24 | (uint32_t)get16(record+8) << 8 | 0x80;
+}
+
+// text is not worth delta coding.
+static bool delta_coded(const uint8_t *record)
+{
+	return record[7] != TAG_EXTENDED_DATA || get16(record+8) != TAG_TEXT_LOG;
+}
+
+// walks the records completely inside a block, calls op(record, previous record of the same key or NULL, size).
+// decoding reads keys and sizes before op restores the record, so those bytes are never delta coded.
+template<class T>
+static void walk_records(uint8_t *block, int first, int size, T &op)
+{
+	uint32_t keys[LOG_BLOCK_MAX_TAGS];
+	int last[LOG_BLOCK_MAX_TAGS];
+	int sizes[LOG_BLOCK_MAX_TAGS];
+	int key_count = 0;
+
+	for(int pos = first; pos + 8 <= size;)
+	{
+		uint8_t *record = block + pos;
+		if (pos + header_length(record, 8) > size)
+			break;
+		int n = record_size(record);
+		if (pos + n > size)
+			break;
+
+		if (delta_coded(record))
+		{
+			uint32_t key = record_key(record);
+			int i = 0;
+			while (i < key_count && keys[i] != key)
+				i++;
+
+			if (i < key_count)
+			{
+				op(record, sizes[i] == n ? block + last[i] : NULL, n);
+				last[i] = pos;
+				sizes[i] = n;
+			}
+			else if (key_count < LOG_BLOCK_MAX_TAGS)
+			{
+				keys[key_count] = key;
+				last[key_count] = pos;
+				sizes[key_count] = n;
+				key_count++;
+			}
+		}
+
+		pos += n;
+	}
+}
+
+// the delta coded parts of a record: low 32 bits of the timestamp, payload as 16 bit words.
+static int payload_offset(const uint8_t *record)
+{
+	return record[7] == TAG_EXTENDED_DATA ? EXTENDED_HEADER_SIZE : 8;
+}
+
+struct delta_encode
+{
+	const uint8_t *raw;
+	uint8_t *delta;
+	void operator()(uint8_t *record, const uint8_t *previous, int size)
+	{
+		if (!previous)
+			return;
+
+		// record and previous point into the delta copy, values are taken from the raw piece.
+		const uint8_t *r = raw + (record - delta);
+		const uint8_t *p = raw + (previous - delta);
+		put32(record, get32(r) - get32(p));
+		for(int i=payload_offset(r); i+2<=size; i+=2)
+			put16(record+i, get16(r+i) - get16(p+i));
+	}
+};
+
+struct delta_decode
+{
+	void operator()(uint8_t *record, const uint8_t *previous, int size)
+	{
+		if (!previous)
+			return;
+
+		put32(record, get32(record) + get32(previous));
+		for(int i=payload_offset(record); i+2<=size; i+=2)
+			put16(record+i, get16(record+i) + get16(previous+i));
+	}
+};
+
+log_block_encoder::log_block_encoder(void *wrkmem)
+:wrkmem((uint8_t*)wrkmem)
+,header_size(0)
+,carry(0)
+{
+	lzo_init();
+}
+
+int log_block_encoder::encode(const void *piece, int size, void *out)
+{
+	const uint8_t *raw = (const uint8_t*)piece;
+	if (size > LOG_BLOCK_MAX_RAW)
+		size = LOG_BLOCK_MAX_RAW;
+
+	// finish the record cut at the end of the last piece.
+	int pos = 0;
+	if (header_size > 0)
+	{
+		while (pos < size && header_size < header_length(header, header_size))
+			header[header_size++] = raw[pos++];
+
+		if (header_size == header_length(header, header_size))
+		{
+			carry = record_size(header) - header_size;
+			header_size = 0;
+		}
+	}
+	int skip = carry < size - pos ? carry : size - pos;
+	pos += skip;
+	carry -= skip;
+	int first = header_size > 0 ? size : pos;
+
+	// find where the stream is cut at the end of this piece.
+	while (pos < size && header_size == 0 && carry == 0)
+	{
+		int n = header_length(raw+pos, size-pos);
+		if (pos + n > size)
+		{
+			header_size = size - pos;
+			memcpy(header, raw+pos, header_size);
+			break;
+		}
+
+		n = record_size(raw+pos);
+		if (pos + n > size)
+			carry = pos + n - size;
+		pos += n;
+	}
+
+	memcpy(delta, raw, size);
+	delta_encode op = {raw, delta};
+	walk_records(delta, first, size, op);
+
+	log_block_header *h = (log_block_header*)out;
+	uint8_t *stored = (uint8_t*)(h+1);
+	lzo_uint stored_size = 0;
+	h->flags = log_block_delta;
+	if (lzo1x_1_compress(delta, size, stored, &stored_size, wrkmem) == LZO_E_OK && stored_size < (lzo_uint)size)
+	{
+		h->flags |= log_block_lzo;
+	}
+	else
+	{
+		memcpy(stored, delta, size);
+		stored_size = size;
+	}
+
+	h->magic = LOG_BLOCK_MAGIC;
+	h->raw_size = size;
+	h->stored_size = stored_size;
+	h->first_record = first;
+	h->crc = 0;
+	h->crc = crc32(0, h, sizeof(log_block_header) + stored_size);
+
+	return sizeof(log_block_header) + stored_size;
+}
+
+// the decompressor hands out data in pieces of blk_size through this, and calls it with NULL on overrun.
+// a block fits in raw as a whole, so there is nothing to do.
+static void __LZO_CDECL block_output(lzo_callback_p, lzo_voidp, lzo_uint)
+{
+}
+
+int log_block_decode(const void *block, int size, void *raw, int *first_record)
+{
+	if (size < (int)sizeof(log_block_header))
+		return -1;
+
+	log_block_header h = *(const log_block_header*)block;
+	const uint8_t *stored = (const uint8_t*)block + sizeof(log_block_header);
+	if (h.magic != LOG_BLOCK_MAGIC || h.raw_size > LOG_BLOCK_MAX_RAW || h.stored_size > LOG_BLOCK_MAX_RAW
+		|| h.first_record > h.raw_size || (int)sizeof(log_block_header) + h.stored_size > size)
+		return -1;
+
+	uint32_t crc = h.crc;
+	h.crc = 0;
+	uint32_t c = crc32(0, &h, sizeof(h));
+	c = crc32(c, stored, h.stored_size);
+	if (c != crc)
+		return -2;
+
+	if (h.flags & log_block_lzo)
+	{
+		lzo_uint raw_size = LOG_BLOCK_MAX_RAW;
+		if (lzo1x_decompress_safe(stored, h.stored_size, (uint8_t*)raw, &raw_size, block_output, LOG_BLOCK_MAX_RAW) != LZO_E_OK || raw_size != h.raw_size)
+			return -3;
+	}
+	else
+	{
+		if (h.stored_size != h.raw_size)
+			return -3;
+		memcpy(raw, stored, h.raw_size);
+	}
+
+	if (h.flags & log_block_delta)
+	{
+		delta_decode op;
+		walk_records((uint8_t*)raw, h.first_record, h.raw_size, op);
+	}
+
+	*first_record = h.first_record;
+	return h.raw_size;
+}
+
+log_reader::log_reader(FILE *f)
+:f(f)
+,is_compressed(false)
+,gap(false)
+,damaged(0)
+,raw_size(0)
+,raw_pos(0)
+{
+	uint32_t magic = 0;
+	if (fread(&magic, 1, 4, f) == 4 && magic == LOG_BLOCK_MAGIC)
+		is_compressed = true;
+	fseek(f, 0, SEEK_SET);
+}
+
+// decode the next good block, skipping damaged ones. returns 0, -1 at the end of file.
+int log_reader::next_block()
+{
+	uint8_t block[LOG_BLOCK_MAX_SIZE];
+	while (1)
+	{
+		long offset = ftell(f);
+		int size = fread(block, 1, sizeof(log_block_header), f);
+		if (size < (int)sizeof(log_block_header))
+			return -1;
+
+		const log_block_header *h = (const log_block_header*)block;
+		int first_record = 0;
+		int stored_size = h->stored_size <= LOG_BLOCK_MAX_RAW ? h->stored_size : 0;
+		size += fread(block+size, 1, stored_size, f);
+		if (h->magic == LOG_BLOCK_MAGIC && (raw_size = log_block_decode(block, size, raw, &first_record)) >= 0)
+		{
+			// after a damaged one, only a block with a record starting in it gets the stream back in step.
+			if (gap && first_record >= raw_size)
+				continue;
+
+			raw_pos = gap ? first_record : 0;
+			return 0;
+		}
+
+		// search the next block from the byte behind this one's start.
+		damaged++;
+		gap = true;
+		fseek(f, offset+1, SEEK_SET);
+		uint32_t magic = 0;
+		int c;
+		while ((c = fgetc(f)) != EOF)
+		{
+			magic = magic >> 8 | (uint32_t)c << 24;
+			if (magic == LOG_BLOCK_MAGIC)
+				break;
+		}
+		if (c == EOF)
+			return -1;
+		fseek(f, -4, SEEK_CUR);
+	}
+}
+
+int log_reader::read(void *out, int count)
+{
+	if (!is_compressed)
+		return fread(out, 1, count, f) == (size_t)count ? 0 : -1;
+
+	uint8_t *p = (uint8_t*)out;
+	while (count > 0)
+	{
+		if (raw_pos >= raw_size)
+		{
+			if (next_block() < 0)
+				return -1;
+			if (gap)
+				return -1;
+		}
+
+		int n = raw_size - raw_pos < count ? raw_size - raw_pos : count;
+		memcpy(p, raw + raw_pos, n);
+		p += n;
+		raw_pos += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+int log_reader::read_record(int64_t *time, uint8_t *tag, uint16_t *tag_ex, void *data, int *size)
+{
+	while (1)
+	{
+		// after a damaged block, reading starts over at a record boundary.
+		gap = false;
+		uint16_t s = 24;
+		*tag_ex = 0xffff;
+		if (read(time, 8) < 0)
+		{
+			if (gap)
+				continue;
+			return -1;
+		}
+
+		*tag = (uint64_t)*time >> 56;
+		*time &= ~((uint64_t)0xff << 56);
+		if (*tag == TAG_EXTENDED_DATA && (read(tag_ex, 2) < 0 || read(&s, 2) < 0))
+		{
+			if (gap)
+				continue;
+			return -1;
+		}
+
+		if (read(data, s) < 0)
+		{
+			if (gap)
+				continue;
+			return -1;
+		}
+
+		*size = s;
+		return 0;
+	}
+}
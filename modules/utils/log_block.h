@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// compressed log container.
+// the log record stream (see log.h) is cut into pieces of up to LOG_BLOCK_MAX_RAW bytes, each stored as one block:
+//   log_block_header + stored bytes
+// inside a block, every record is delta coded against the previous record of the same tag in that block:
+//   the low 32 bits of its timestamp and its payload as 16 bit words, tag/size fields stay as they are.
+// then the block is compressed with LZO1X-1, or stored as is if that does not make it smaller.
+// no state is carried between blocks: a reader can start at any block (search for LOG_BLOCK_MAGIC),
+// first_record tells where the first record starting in it begins, and a damaged block loses only itself.
+
+#define LOG_BLOCK_MAGIC 0x315a4c59				// "YLZ1"
+#define LOG_BLOCK_MAX_RAW 2048
+#define LOG_BLOCK_MAX_SIZE (sizeof(log_block_header) + LOG_BLOCK_MAX_RAW + LOG_BLOCK_MAX_RAW/16 + 64 + 3)	// LZO worst case
+#define LOG_BLOCK_WRKMEM ((1<<12) * sizeof(void*))	// LZO1X-1 dictionary of minilzo
+#define LOG_BLOCK_MAX_TAGS 32					// tags delta coded per block
+
+enum log_block_flags
+{
+	log_block_lzo = 1,
+	log_block_delta = 2,
+};
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t raw_size;					// bytes of the record stream in this block
+	uint16_t stored_size;				// bytes behind the header
+	uint16_t first_record;				// offset of the first record starting here, raw_size if none does
+	uint16_t flags;						// log_block_flags
+	uint32_t crc;						// crc32 of the header with crc = 0, and the stored bytes
+} log_block_header;
+
+// turns pieces of the record stream into blocks, keeping track of records cut between pieces.
+class log_block_encoder
+{
+public:
+	// wrkmem: LOG_BLOCK_WRKMEM bytes for the compressor.
+	log_block_encoder(void *wrkmem);
+	~log_block_encoder(){}
+
+	// encode the next piece of the stream, out must hold LOG_BLOCK_MAX_SIZE bytes. returns the block size.
+	int encode(const void *piece, int size, void *out);
+
+protected:
+	uint8_t *wrkmem;
+	uint8_t delta[LOG_BLOCK_MAX_RAW];
+	uint8_t header[12];				// header of a record cut at the end of the last piece
+	int header_size;
+	int carry;						// bytes of a record cut at the end of the last piece which are still to come
+};
+
+// decode a block, raw must hold LOG_BLOCK_MAX_RAW bytes.
+// returns the raw size and *first_record, negative values if the block is damaged.
+int log_block_decode(const void *block, int size, void *raw, int *first_record);
+
+// reads records from a log file, compressed or not.
+class log_reader
+{
+public:
+	log_reader(FILE *f);
+	~log_reader(){}
+
+	bool compressed(){return is_compressed;}
+
+	// the next record: timestamp without tag, tag, extended tag (0xffff for fixed size records) and payload.
+	// data must hold 65535 bytes. returns 0, -1 at the end of file.
+	// a record hit by a damaged block is skipped, reading goes on at the next good block.
+	int read_record(int64_t *time, uint8_t *tag, uint16_t *tag_ex, void *data, int *size);
+
+	int damaged_blocks(){return damaged;}
+
+protected:
+	int read(void *out, int count);
+	int next_block();
+
+	FILE *f;
+	bool is_compressed;
+	bool gap;							// a damaged block was skipped during the current record
+	int damaged;
+	uint8_t raw[LOG_BLOCK_MAX_RAW];
+	int raw_size;
+	int raw_pos;
+};
@@ -0,0 +1,160 @@
+#include "log_drop.h"
+#include <string.h>
+
+int log_record_priority(uint8_t tag, uint16_t tag_ex)
+{
+	if (tag == TAG_EXTENDED_DATA)
+	{
+		switch (tag_ex)
+		{
+		case TAG_EKF_DATA:
+		case TAG_POS_ESTIMATOR2:
+		case TAG_ACC_DATA:
+		case 5:						// raw imu samples
+		case TAG_IMU_BURST:
+			return log_priority_high;
+		case TAG_TEXT_LOG:
+		case TAG_MOTOR_MIXER:
+		case TAG_UBX_SAT_DATA:
+			return log_priority_low;
+		default:
+			return log_priority_normal;
+		}
+	}
+
+	switch (tag)
+	{
+	case TAG_SENSOR_DATA:
+	case TAG_IMU_DATA:
+	case TAG_IMU_DATA_V1:
+	case TAG_DOUBLE_SENSOR_DATA:
+	case TAG_QUADCOPTER_DATA:
+	case TAG_PPM_DATA:
+		return log_priority_high;
+	case TAG_RAW_DATA:
+		return log_priority_low;
+	default:
+		return log_priority_normal;
+	}
+}
+
+int log_headroom(int priority, int buffer_size)
+{
+	if (priority == log_priority_low)
+		return buffer_size / 2;
+	if (priority == log_priority_normal)
+		return buffer_size / 8;
+
+	return 0;
+}
+
+log_drop_counter::log_drop_counter()
+:slot_count(0)
+,first(0)
+,last(0)
+,total_dropped(0)
+,reported_dropped(0)
+{
+	memset(slots, 0, sizeof(slots));
+	for(int i=0; i<3; i++)
+		busy_count[i] = reported_busy[i] = marker_busy[i] = 0;
+}
+
+void log_drop_counter::dropped(uint8_t tag, uint16_t tag_ex, int size, int64_t time)
+{
+	int i = 0;
+	while (i < slot_count && (slots[i].tag != tag || slots[i].tag_ex != tag_ex))
+		i++;
+
+	if (i == slot_count)
+	{
+		if (slot_count < LOG_DROP_SLOTS)
+		{
+			slots[i].tag = tag;
+			slots[i].tag_ex = tag_ex;
+			slot_count++;
+		}
+		else
+		{
+			i = LOG_DROP_SLOTS;
+		}
+	}
+
+	slots[i].records++;
+	slots[i].bytes += size;
+
+	if (total_dropped == reported_dropped)
+		first = time;
+	last = time;
+	total_dropped++;
+}
+
+void log_drop_counter::busy(int priority)
+{
+	busy_count[priority]++;
+}
+
+uint32_t log_drop_counter::total_busy()
+{
+	return busy_count[0] + busy_count[1] + busy_count[2];
+}
+
+bool log_drop_counter::pending()
+{
+	if (total_dropped != reported_dropped)
+		return true;
+
+	for(int i=0; i<3; i++)
+		if (busy_count[i] != reported_busy[i])
+			return true;
+
+	return false;
+}
+
+int log_drop_counter::marker(void *out)
+{
+	log_drop_header *h = (log_drop_header*)out;
+	log_drop_entry *e = (log_drop_entry*)(h+1);
+
+	bool any = total_dropped != reported_dropped;
+	h->first = any ? first : 0;		// 0 if only busy drops are in it
+	h->last = any ? last : 0;
+	h->count = 0;
+	h->reserved = 0;
+	for(int i=0; i<3; i++)
+	{
+		marker_busy[i] = busy_count[i];
+		h->busy[i] = marker_busy[i] - reported_busy[i];
+	}
+
+	for(int i=0; i<=LOG_DROP_SLOTS; i++)
+	{
+		const slot &s = slots[i];
+		if (s.records == s.reported_records)
+			continue;
+
+		e->tag = i < LOG_DROP_SLOTS ? s.tag : 0;
+		e->tag_ex = i < LOG_DROP_SLOTS ? s.tag_ex : 0;
+		e->priority = i < LOG_DROP_SLOTS ? log_record_priority(s.tag, s.tag_ex) : log_priority_normal;
+		e->records = s.records - s.reported_records;
+		e->bytes = s.bytes - s.reported_bytes;
+		e++;
+		h->count++;
+	}
+
+	return (uint8_t*)e - (uint8_t*)out;
+}
+
+void log_drop_counter::reported()
+{
+	for(int i=0; i<=LOG_DROP_SLOTS; i++)
+	{
+		slots[i].reported_records = slots[i].records;
+		slots[i].reported_bytes = slots[i].bytes;
+	}
+
+	// busy counters may have moved since marker(), what was not in it goes into the next one.
+	reported_dropped = total_dropped;
+	for(int i=0; i<3; i++)
+		reported_busy[i] = marker_busy[i];
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <Protocol/RFData.h>
+
+// what the logger sheds first when the storage stalls and its ring fills up.
+enum log_priority
+{
+	log_priority_high = 0,		// IMU, EKF, estimator and attitude records, kept while there is any room
+	log_priority_normal = 1,
+	log_priority_low = 2,		// text logs and debug records, dropped first
+};
+
+#define LOG_DROP_SLOTS 16		// tags counted one by one, the rest is counted as "other tags"
+#define LOG_DROP_MAX_MARKER (sizeof(log_drop_header) + (LOG_DROP_SLOTS+1) * sizeof(log_drop_entry))
+
+int log_record_priority(uint8_t tag, uint16_t tag_ex);
+
+// bytes a record of this priority must leave free in a ring of buffer_size bytes,
+// so that higher priority records still find room after lower ones are refused.
+int log_headroom(int priority, int buffer_size);
+
+// drop accounting of the logger, reported in the stream by TAG_LOG_DROPPED records.
+// dropped() and marker() are for the context holding the ring, busy() for the one which found it locked,
+// so each counter has exactly one writer.
+class log_drop_counter
+{
+public:
+	log_drop_counter();
+	~log_drop_counter(){}
+
+	void dropped(uint8_t tag, uint16_t tag_ex, int size, int64_t time);
+	void busy(int priority);
+
+	// drops not yet reported.
+	bool pending();
+
+	// build a TAG_LOG_DROPPED payload of everything not yet reported, out must hold LOG_DROP_MAX_MARKER bytes.
+	// returns its size, call reported() once it is in the ring.
+	int marker(void *out);
+	void reported();
+
+	uint32_t total(){return total_dropped + total_busy();}
+
+protected:
+	uint32_t total_busy();
+
+	typedef struct
+	{
+		uint8_t tag;
+		uint16_t tag_ex;
+		uint32_t records;
+		uint32_t bytes;
+		uint32_t reported_records;
+		uint32_t reported_bytes;
+	} slot;
+
+	slot slots[LOG_DROP_SLOTS+1];		// the last one is "other tags"
+	int slot_count;
+	int64_t first;
+	int64_t last;
+	uint32_t total_dropped;
+	uint32_t reported_dropped;
+	volatile uint32_t busy_count[3];
+	uint32_t reported_busy[3];
+	uint32_t marker_busy[3];
+};
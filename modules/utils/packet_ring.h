@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// single producer single consumer ring of variable length packets, lock free.
+// packets are stored contiguously in a preallocated buffer: [int size][int flags][data, padded to 8 bytes],
+// a record that does not fit before the end of the buffer is placed at the start,
+// with a size=-1 marker in the skipped tail.
+// producer: reserve() + commit(), or push().  consumer: peek() + consume(), or pop().
+// head and tail are free running byte counters, each written by one side only.
+template<int capacity>		// bytes, power of 2
+class PacketRing
+{
+public:
+	PacketRing():head(0), tail(0), pushed(0), popped(0), dropped(0){}
+	~PacketRing(){}
+
+	// producer: space for a packet of up to max_size bytes, NULL if the ring is full.
+	uint8_t *reserve(int max_size)
+	{
+		int need = record_size(max_size);
+		uint32_t h = head;
+		uint32_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+		int pos = h & (capacity-1);
+		int to_end = capacity - pos;
+		int skip = need > to_end ? to_end : 0;
+
+		if (need > capacity || (int)(h - t) + skip + need > capacity)
+		{
+			dropped++;
+			return NULL;
+		}
+
+		if (skip)
+		{
+			*(int*)(buffer+pos) = -1;
+			pos = 0;
+		}
+
+		reserved_skip = skip;
+		return buffer + pos + 2*sizeof(int);
+	}
+
+	// producer: publish the packet of the last reserve(), size <= max_size.
+	// flags are the producer's, handed to the consumer as is.
+	void commit(int size, int flags = 0)
+	{
+		uint32_t h = head + reserved_skip;
+		int *record = (int*)(buffer + (h & (capacity-1)));
+		record[0] = size;
+		record[1] = flags;
+		__atomic_store_n(&head, h + record_size(size), __ATOMIC_RELEASE);
+		__atomic_store_n(&pushed, pushed+1, __ATOMIC_RELEASE);
+	}
+
+	// producer: copy a packet in, returns 0 on success, -1 if full.
+	int push(const void *data, int size)
+	{
+		uint8_t *p = reserve(size);
+		if (!p)
+			return -1;
+		memcpy(p, data, size);
+		commit(size);
+		return 0;
+	}
+
+	// consumer: size of the first packet and *data pointing to it, -1 if empty.
+	// the data stays valid until consume(). *flags gets the flags of commit() if flags is not NULL.
+	int peek(const uint8_t **data, int *flags = NULL)
+	{
+		uint32_t t = tail;
+		if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+			return -1;
+
+		int pos = t & (capacity-1);
+		int size = *(int*)(buffer+pos);
+		if (size < 0)
+		{
+			// wrapped record, skip the tail marker
+			t += capacity - pos;
+			__atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+			pos = 0;
+			size = *(int*)buffer;
+		}
+
+		if (flags)
+			*flags = *(int*)(buffer+pos+sizeof(int));
+		*data = buffer + pos + 2*sizeof(int);
+		return size;
+	}
+
+	// consumer: remove the first packet, peek() must have returned it.
+	void consume()
+	{
+		uint32_t t = tail;
+		int size = *(int*)(buffer + (t & (capacity-1)));
+		__atomic_store_n(&tail, t + record_size(size), __ATOMIC_RELEASE);
+		__atomic_store_n(&popped, popped+1, __ATOMIC_RELEASE);
+	}
+
+	// consumer: copy the first packet out, returns its size (truncated to max_size), -1 if empty.
+	int pop(void *out, int max_size, bool remove = true, int *flags = NULL)
+	{
+		const uint8_t *p;
+		int size = peek(&p, flags);
+		if (size < 0)
+			return -1;
+
+		if (size > max_size)
+			size = max_size;
+		memcpy(out, p, size);
+		if (remove)
+			consume();
+		return size;
+	}
+
+	// packets in the ring, callable from both sides.
+	// a packet counted here is visible to peek().
+	int count()
+	{
+		return __atomic_load_n(&pushed, __ATOMIC_ACQUIRE) - __atomic_load_n(&popped, __ATOMIC_ACQUIRE);
+	}
+
+	// packets rejected by reserve() because the ring was full.
+	int dropped_count(){return dropped;}
+
+protected:
+	static int record_size(int size){return (2*sizeof(int) + size + 7) & ~7;}
+
+	uint8_t buffer[capacity] __attribute__((aligned(8)));
+	uint32_t head;				// written by producer
+	uint32_t tail;				// written by consumer
+	uint32_t pushed;
+	uint32_t popped;
+	int dropped;
+	int reserved_skip;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+// single producer single consumer queue of small elements (pointers, indexes), lock free.
+// head and tail are free running counters, each written by one side only.
+template<class T, int capacity>		// power of 2
+class SPSCQueue
+{
+public:
+	SPSCQueue():head(0), tail(0){}
+	~SPSCQueue(){}
+
+	// producer: returns 0 on success, -1 if full.
+	int push(const T &v)
+	{
+		uint32_t h = head;
+		if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= (uint32_t)capacity)
+			return -1;
+
+		elements[h & (capacity-1)] = v;
+		__atomic_store_n(&head, h+1, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	// consumer: returns 0 and *out on success, -1 if empty.
+	int pop(T *out)
+	{
+		uint32_t t = tail;
+		if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+			return -1;
+
+		*out = elements[t & (capacity-1)];
+		__atomic_store_n(&tail, t+1, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	// elements in the queue, callable from both sides.
+	int count()
+	{
+		return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+	}
+
+protected:
+	T elements[capacity];
+	uint32_t head;				// written by producer
+	uint32_t tail;				// written by consumer
+};